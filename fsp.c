@@ -24,264 +24,3822 @@
 #include <fsp_config.h>
 #endif
 
+#if defined(HAVE_SYS_MMAN_H) || defined(FSP_TRACE)
+/* Expose mmap()/madvise(), clock_gettime() and friends under strict C
+ * standards */
+#define _DEFAULT_SOURCE 1
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#ifdef __linux__
+/* mremap() for the mmap-backed allocator lives in the GNU namespace */
+#define _GNU_SOURCE 1
+#endif
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "fsp.h"
-#include "fsp_internal.h"
+#ifdef FSP_TRACE
+#include <time.h>  /* Trace record timestamps on non-x86-64 targets */
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+/* Spill-to-disk overflow (fsp_config.spill_threshold) needs the same
+ * POSIX file APIs as the mmap support */
+#define FSP_HAVE_SPILL 1
+/* ...as does the fd-driven I/O layer (fsp_attach_fd) */
+#define FSP_HAVE_IO 1
+/* ...and the mmap-backed allocator (fsp_use_mmap_allocator) */
+#define FSP_HAVE_MMAP_ALLOC 1
+#endif
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "fsp.h"
+/* Keep the general entry points when the embedding build sets the
+ * specialization defines (see the profile at the end of fsp_internal.h) */
+#define FSP_BUILDING_LIBFSP 1
+#include "fsp_internal.h"
+
+#ifndef FSP_DEFAULT_BUFFER_SIZE
+#define FSP_DEFAULT_BUFFER_SIZE (64 * 1024)  /* 64KB */
+#endif
+
+/* Minimum stream buffer space reserved per decompression step when an
+ * input filter is set (fsp_set_input_filter) */
+#ifndef FSP_FILTER_MIN_OUTPUT
+#define FSP_FILTER_MIN_OUTPUT 4096
+#endif
+
+/* Minimum stream buffer space reserved per read() by the fd-driven
+ * I/O layer (fsp_on_readable) */
+#ifndef FSP_IO_READ_SIZE
+#define FSP_IO_READ_SIZE 4096
+#endif
+
+/* Atomic index accesses for the SPSC handoff mode (fsp_set_spsc).
+ * Each side publishes its own index with a release store and observes
+ * the other side's with an acquire load, which is all the ordering a
+ * single-producer/single-consumer ring needs. */
+#if defined(__GNUC__) || defined(__clang__)
+#define FSP_HAVE_ATOMICS 1
+#define FSP_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define FSP_ATOMIC_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#endif
+
+/* SIMD-accelerated delimiter scanning (fsp_scan_delims): pick the
+ * widest vector implementation the running CPU supports, falling back
+ * to a scalar loop */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FSP_SCAN_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define FSP_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef size_t (*fsp_scan_fn)(const char *data, size_t length,
+                              int delim1, int delim2);
+
+/* Allocator installed by fsp_set_allocator(); all-NULL means libc */
+static fsp_allocator fsp_current_allocator = { NULL, NULL, NULL, NULL, NULL };
+
+/* Context pool (fsp_set_context_pool_size); 0 max = pooling disabled */
+static fsp_context *fsp_context_pool_head = NULL;
+static size_t fsp_context_pool_count = 0;
+static size_t fsp_context_pool_max = 0;
+
+/* Adaptive pre-sizing histogram (FSP_SIZE_ADAPTIVE): log2 buckets of
+ * the peak unread backlog each destroyed context saw, aggregated with
+ * relaxed atomic increments so pool worker threads contribute without
+ * locking.  fsp_create_with_config() pre-sizes at the 90th percentile. */
+#define FSP_ADAPTIVE_BUCKETS 48
+static size_t fsp_adaptive_histogram[FSP_ADAPTIVE_BUCKETS];
+
+
+/* Add a destroyed context's peak unread backlog to the histogram;
+ * contexts that never buffered anything carry no sizing signal */
+static void
+fsp_adaptive_note(fsp_context *ctx)
+{
+  size_t backlog = ctx->stats.peak_unread;
+  int bucket = 0;
+
+  if(!backlog)
+    return;
+
+  while(bucket < FSP_ADAPTIVE_BUCKETS - 1 &&
+        ((size_t)1 << bucket) < backlog)
+    bucket++;
+
+#ifdef FSP_HAVE_ATOMICS
+  __atomic_fetch_add(&fsp_adaptive_histogram[bucket], 1, __ATOMIC_RELAXED);
+#else
+  fsp_adaptive_histogram[bucket]++;
+#endif
+}
+
+
+/**
+ * fsp_adaptive_size - Get the learned adaptive pre-size
+ *
+ * Walks the shared backlog histogram to the 90th percentile bucket,
+ * the capacity FSP_SIZE_ADAPTIVE contexts are created with.
+ *
+ * Returns: The learned capacity in bytes, or 0 when no destroyed
+ * context has contributed a sample yet
+ */
+size_t
+fsp_adaptive_size(void)
+{
+  size_t counts[FSP_ADAPTIVE_BUCKETS];
+  size_t total = 0;
+  size_t target;
+  size_t seen = 0;
+  int bucket;
+
+  for(bucket = 0; bucket < FSP_ADAPTIVE_BUCKETS; bucket++) {
+#ifdef FSP_HAVE_ATOMICS
+    counts[bucket] = FSP_ATOMIC_LOAD(&fsp_adaptive_histogram[bucket]);
+#else
+    counts[bucket] = fsp_adaptive_histogram[bucket];
+#endif
+    total += counts[bucket];
+  }
+
+  if(!total)
+    return 0;
+
+  /* 90th percentile: the bucket below which 90% of backlogs fall */
+  target = total - total / 10;
+  for(bucket = 0; bucket < FSP_ADAPTIVE_BUCKETS; bucket++) {
+    seen += counts[bucket];
+    if(seen >= target)
+      break;
+  }
+
+  return (size_t)1 << bucket;
+}
+
+
+/**
+ * fsp_adaptive_reset - Discard the learned sizing statistics
+ *
+ * Zeroes the shared backlog histogram so FSP_SIZE_ADAPTIVE contexts
+ * fall back to the default size until new samples accumulate - for
+ * tests, or after a workload change makes the history misleading.
+ * Not thread-safe against concurrent context destruction.
+ */
+void
+fsp_adaptive_reset(void)
+{
+  memset(fsp_adaptive_histogram, '\0', sizeof(fsp_adaptive_histogram));
+}
+
+
+/**
+ * fsp_set_allocator - Install a pluggable allocator for all library allocations
+ *
+ * @allocator: Allocator vtable to copy, or NULL to restore libc
+ *
+ * Any hook left NULL falls back to the matching libc function.  Not
+ * thread-safe: call before creating any context and do not change the
+ * allocator while contexts (or pooled contexts) exist.
+ */
+void
+fsp_set_allocator(const fsp_allocator *allocator)
+{
+  if(allocator)
+    fsp_current_allocator = *allocator;
+  else
+    memset(&fsp_current_allocator, '\0', sizeof(fsp_current_allocator));
+}
+
+
+void*
+fsp_alloc_malloc(size_t size)
+{
+  if(fsp_current_allocator.malloc_fn)
+    return fsp_current_allocator.malloc_fn(size,
+                                           fsp_current_allocator.user_data);
+  return malloc(size);
+}
+
+
+void*
+fsp_alloc_calloc(size_t nmemb, size_t size)
+{
+  if(fsp_current_allocator.calloc_fn)
+    return fsp_current_allocator.calloc_fn(nmemb, size,
+                                           fsp_current_allocator.user_data);
+  return calloc(nmemb, size);
+}
+
+
+void*
+fsp_alloc_realloc(void *ptr, size_t size)
+{
+  if(fsp_current_allocator.realloc_fn)
+    return fsp_current_allocator.realloc_fn(ptr, size,
+                                            fsp_current_allocator.user_data);
+  return realloc(ptr, size);
+}
+
+
+void
+fsp_alloc_free(void *ptr)
+{
+  if(fsp_current_allocator.free_fn) {
+    fsp_current_allocator.free_fn(ptr, fsp_current_allocator.user_data);
+    return;
+  }
+  free(ptr);
+}
+
+
+#ifdef FSP_HAVE_MMAP_ALLOC
+
+/* mmap-backed allocator (fsp_use_mmap_allocator): allocations at or
+ * above the installed threshold come straight from mmap() so large
+ * stream buffers get page-aligned storage, transparent huge pages and
+ * copy-free growth via mremap().  Every allocation carries a header
+ * in its first FSP_MMAP_ALLOC_HEADER bytes, which keeps mmap-backed
+ * payloads page (and so 64-byte cache line) aligned and lets free and
+ * realloc recover the backing store and mapping length. */
+
+#define FSP_MMAP_ALLOC_HEADER 64
+
+/* Default size above which allocations switch from malloc to mmap */
+#ifndef FSP_MMAP_ALLOC_THRESHOLD
+#define FSP_MMAP_ALLOC_THRESHOLD (1024 * 1024)  /* 1MB */
+#endif
+
+/* Mappings at least this large are flagged MADV_HUGEPAGE so the
+ * kernel can back them with 2MB TLB entries */
+#ifndef FSP_MMAP_HUGE_THRESHOLD
+#define FSP_MMAP_HUGE_THRESHOLD (2 * 1024 * 1024)  /* 2MB */
+#endif
+
+#define FSP_MMAP_ALLOC_MAGIC 0x4653504DU  /* "FSPM" */
+
+typedef struct fsp_mmap_alloc_header_s {
+  unsigned int magic;              /* FSP_MMAP_ALLOC_MAGIC */
+  int is_mapped;                   /* 1 = mmap-backed, 0 = malloc-backed */
+  size_t size;                     /* Payload bytes requested */
+  size_t mapping_length;           /* Whole mapping incl. header (mmap) */
+} fsp_mmap_alloc_header;
+
+static size_t fsp_mmap_alloc_threshold = FSP_MMAP_ALLOC_THRESHOLD;
+
+/* Round a mapping up to whole pages */
+static size_t
+fsp_mmap_alloc_round(size_t length)
+{
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+  return (length + page_size - 1) & ~(page_size - 1);
+}
+
+static void
+fsp_mmap_alloc_advise(void *base, size_t mapping_length)
+{
+#ifdef MADV_HUGEPAGE
+  if(mapping_length >= FSP_MMAP_HUGE_THRESHOLD)
+    (void)madvise(base, mapping_length, MADV_HUGEPAGE);
+#else
+  (void)base;
+  (void)mapping_length;
+#endif
+}
+
+static void*
+fsp_mmap_alloc_malloc(size_t size, void *user_data)
+{
+  fsp_mmap_alloc_header *header;
+
+  (void)user_data;
+
+  if(size >= fsp_mmap_alloc_threshold) {
+    size_t mapping_length = fsp_mmap_alloc_round(size +
+                                                 FSP_MMAP_ALLOC_HEADER);
+    void *base = mmap(NULL, mapping_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+      return NULL;
+
+    fsp_mmap_alloc_advise(base, mapping_length);
+
+    header = (fsp_mmap_alloc_header*)base;
+    header->magic = FSP_MMAP_ALLOC_MAGIC;
+    header->is_mapped = 1;
+    header->size = size;
+    header->mapping_length = mapping_length;
+    return (char*)base + FSP_MMAP_ALLOC_HEADER;
+  }
+
+  header = (fsp_mmap_alloc_header*)malloc(size + FSP_MMAP_ALLOC_HEADER);
+  if(!header)
+    return NULL;
+
+  header->magic = FSP_MMAP_ALLOC_MAGIC;
+  header->is_mapped = 0;
+  header->size = size;
+  header->mapping_length = 0;
+  return (char*)header + FSP_MMAP_ALLOC_HEADER;
+}
+
+static void*
+fsp_mmap_alloc_calloc(size_t nmemb, size_t size, void *user_data)
+{
+  size_t total;
+  void *ptr;
+
+  if(size && nmemb > (size_t)-1 / size)
+    return NULL;
+  total = nmemb * size;
+
+  ptr = fsp_mmap_alloc_malloc(total, user_data);
+  /* Fresh mappings are already zero-filled */
+  if(ptr && total < fsp_mmap_alloc_threshold)
+    memset(ptr, '\0', total);
+  return ptr;
+}
+
+static void
+fsp_mmap_alloc_free(void *ptr, void *user_data)
+{
+  fsp_mmap_alloc_header *header;
+
+  (void)user_data;
+
+  if(!ptr)
+    return;
+
+  header = (fsp_mmap_alloc_header*)((char*)ptr - FSP_MMAP_ALLOC_HEADER);
+  if(header->is_mapped)
+    (void)munmap(header, header->mapping_length);
+  else
+    free(header);
+}
+
+static void*
+fsp_mmap_alloc_realloc(void *ptr, size_t size, void *user_data)
+{
+  fsp_mmap_alloc_header *header;
+
+  if(!ptr)
+    return fsp_mmap_alloc_malloc(size, user_data);
+
+  header = (fsp_mmap_alloc_header*)((char*)ptr - FSP_MMAP_ALLOC_HEADER);
+
+  if(header->is_mapped) {
+    size_t mapping_length = fsp_mmap_alloc_round(size +
+                                                 FSP_MMAP_ALLOC_HEADER);
+
+    if(mapping_length == header->mapping_length) {
+      header->size = size;
+      return ptr;
+    }
+
+#ifdef MREMAP_MAYMOVE
+    {
+      /* Grow (or shrink) in place when possible; a moved mapping is
+       * still copy-free - the kernel just remaps the pages */
+      void *base = mremap(header, header->mapping_length, mapping_length,
+                          MREMAP_MAYMOVE);
+      if(base == MAP_FAILED)
+        return NULL;
+
+      fsp_mmap_alloc_advise(base, mapping_length);
+
+      header = (fsp_mmap_alloc_header*)base;
+      header->size = size;
+      header->mapping_length = mapping_length;
+      return (char*)base + FSP_MMAP_ALLOC_HEADER;
+    }
+#else
+    {
+      /* No mremap(): fall back to map-copy-unmap */
+      size_t copy_length = header->size < size ? header->size : size;
+      void *new_ptr = fsp_mmap_alloc_malloc(size, user_data);
+
+      if(!new_ptr)
+        return NULL;
+      memcpy(new_ptr, ptr, copy_length);
+      (void)munmap(header, header->mapping_length);
+      return new_ptr;
+    }
+#endif
+  }
+
+  if(size >= fsp_mmap_alloc_threshold) {
+    /* Crossing the threshold: migrate the payload into a mapping */
+    void *new_ptr = fsp_mmap_alloc_malloc(size, user_data);
+
+    if(!new_ptr)
+      return NULL;
+    memcpy(new_ptr, ptr, header->size < size ? header->size : size);
+    free(header);
+    return new_ptr;
+  }
+
+  header = (fsp_mmap_alloc_header*)realloc(header,
+                                           size + FSP_MMAP_ALLOC_HEADER);
+  if(!header)
+    return NULL;
+
+  header->size = size;
+  return (char*)header + FSP_MMAP_ALLOC_HEADER;
+}
+
+#endif /* FSP_HAVE_MMAP_ALLOC */
+
+
+/**
+ * fsp_use_mmap_allocator - Install the mmap-backed large-buffer allocator
+ *
+ * @threshold: Allocation size in bytes at which memory switches from
+ *   malloc to mmap (0 = default 1MB)
+ *
+ * Installs (via fsp_set_allocator()) a built-in allocator that serves
+ * allocations of @threshold bytes or more directly from mmap(): the
+ * payload is 64-byte aligned, mappings of 2MB or more are advised
+ * MADV_HUGEPAGE for large TLB coverage, and growth goes through
+ * mremap() so growing a large stream buffer remaps pages instead of
+ * copying them.  Smaller allocations still come from malloc.
+ *
+ * The fsp_set_allocator() caveats apply: install before creating any
+ * context and do not switch allocators while contexts (or pooled
+ * contexts) exist.
+ *
+ * Returns: 0 on success, -1 if mmap support is not built in
+ */
+int
+fsp_use_mmap_allocator(size_t threshold)
+{
+#ifdef FSP_HAVE_MMAP_ALLOC
+  fsp_allocator allocator;
+
+  fsp_mmap_alloc_threshold = threshold ? threshold :
+                                         FSP_MMAP_ALLOC_THRESHOLD;
+
+  allocator.malloc_fn = fsp_mmap_alloc_malloc;
+  allocator.calloc_fn = fsp_mmap_alloc_calloc;
+  allocator.realloc_fn = fsp_mmap_alloc_realloc;
+  allocator.free_fn = fsp_mmap_alloc_free;
+  allocator.user_data = NULL;
+  fsp_set_allocator(&allocator);
+  return 0;
+#else
+  (void)threshold;
+  return -1;
+#endif
+}
+
+
+#ifdef FSP_TRACE
+
+/* Cycle-accurate timestamp: raw TSC on x86-64 (a couple of cycles),
+ * CLOCK_MONOTONIC_RAW nanoseconds elsewhere */
+static unsigned long long
+fsp_trace_now(void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+         (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+/* Append one record to the trace ring: a timestamp read and a few
+ * stores.  Single writer (the thread driving the context); the write
+ * index is release-stored so a drain on another thread only ever sees
+ * complete records.  A full ring drops the record - the sequence gap
+ * makes the loss visible downstream. */
+static void
+fsp_trace_emit(fsp_context *ctx, unsigned int event, size_t bytes)
+{
+  size_t write_index = ctx->trace_write;
+  size_t read_index;
+  fsp_trace_record *record;
+
+#ifdef FSP_HAVE_ATOMICS
+  read_index = FSP_ATOMIC_LOAD(&ctx->trace_read);
+#else
+  read_index = ctx->trace_read;
+#endif
+
+  ctx->trace_sequence++;
+  if(write_index - read_index >= ctx->trace_capacity)
+    return;
+
+  record = &ctx->trace_records[write_index & (ctx->trace_capacity - 1)];
+  record->timestamp = fsp_trace_now();
+  record->sequence = ctx->trace_sequence;
+  record->event = event;
+  record->bytes = bytes;
+
+#ifdef FSP_HAVE_ATOMICS
+  FSP_ATOMIC_STORE(&ctx->trace_write, write_index + 1);
+#else
+  ctx->trace_write = write_index + 1;
+#endif
+}
+
+/* Hook placed on the hot paths; compiles to nothing without FSP_TRACE
+ * and to one predictable branch when tracing is built in but not
+ * enabled on the context */
+#define FSP_TRACE_EVENT(ctx, event, bytes) \
+  do { \
+    if((ctx)->trace_records) \
+      fsp_trace_emit(ctx, event, bytes); \
+  } while(0)
+
+#else
+#define FSP_TRACE_EVENT(ctx, event, bytes)
+#endif /* FSP_TRACE */
+
+
+/**
+ * fsp_trace_enable - Arm (or disarm) per-context hot-path tracing
+ *
+ * @ctx: The context to trace
+ * @capacity: Records to buffer, rounded up to a power of two;
+ *   0 releases the ring and disables tracing
+ *
+ * Only available when the library was built with -DFSP_TRACE=1; the
+ * buffered records are exported with fsp_trace_drain().  Enabling
+ * resets the sequence counter.
+ *
+ * Returns: 0 on success, -1 on failure or when tracing is not built in
+ */
+int
+fsp_trace_enable(fsp_context *ctx, size_t capacity)
+{
+#ifdef FSP_TRACE
+  size_t rounded = 1;
+
+  if(!ctx)
+    return -1;
+
+  if(ctx->trace_records) {
+    FSP_FREE(fsp_trace_record*, ctx->trace_records);
+    ctx->trace_records = NULL;
+    ctx->trace_capacity = 0;
+  }
+  ctx->trace_write = 0;
+  ctx->trace_read = 0;
+  ctx->trace_sequence = 0;
+
+  if(!capacity)
+    return 0;
+
+  while(rounded < capacity)
+    rounded <<= 1;
+
+  ctx->trace_records = FSP_MALLOC(fsp_trace_record*,
+                                  rounded * sizeof(fsp_trace_record));
+  if(!ctx->trace_records)
+    return -1;
+
+  ctx->trace_capacity = rounded;
+  return 0;
+#else
+  (void)ctx;
+  (void)capacity;
+  return -1;
+#endif
+}
+
+
+/**
+ * fsp_trace_drain - Export and release buffered trace records
+ *
+ * @ctx: The traced context
+ * @callback: Invoked once per record, oldest first
+ * @user_data: Opaque pointer passed to @callback
+ *
+ * Safe to call from a thread other than the one driving the context:
+ * the drain side only advances the read index, matching the ring's
+ * single-producer/single-consumer discipline.
+ *
+ * Returns: Number of records drained
+ */
+size_t
+fsp_trace_drain(fsp_context *ctx, fsp_trace_callback callback,
+                void *user_data)
+{
+#ifdef FSP_TRACE
+  size_t read_index;
+  size_t write_index;
+  size_t drained = 0;
+
+  if(!ctx || !ctx->trace_records || !callback)
+    return 0;
+
+  read_index = ctx->trace_read;
+#ifdef FSP_HAVE_ATOMICS
+  write_index = FSP_ATOMIC_LOAD(&ctx->trace_write);
+#else
+  write_index = ctx->trace_write;
+#endif
+
+  while(read_index != write_index) {
+    callback(&ctx->trace_records[read_index & (ctx->trace_capacity - 1)],
+             user_data);
+    read_index++;
+    drained++;
+  }
+
+#ifdef FSP_HAVE_ATOMICS
+  FSP_ATOMIC_STORE(&ctx->trace_read, read_index);
+#else
+  ctx->trace_read = read_index;
+#endif
+
+  return drained;
+#else
+  (void)ctx;
+  (void)callback;
+  (void)user_data;
+  return 0;
+#endif
+}
+
+
+/* Record the current unread backlog high-water mark */
+static void
+fsp_stats_note_unread(fsp_context *ctx)
+{
+  size_t unread;
+
+  if(ctx->ring_mode)
+    unread = ctx->data_length;
+  else
+    unread = ctx->data_length - ctx->read_position;
+
+  if(unread > ctx->stats.peak_unread)
+    ctx->stats.peak_unread = unread;
+}
+
+
+/* Record the '\n' offsets in @length new stream bytes at @data using
+ * the vectorized scan, then advance the indexed stream length.  Called
+ * wherever new bytes enter the stream; spilled borrowed bytes were
+ * indexed when first pushed and are skipped via newline_suppress. */
+static int
+fsp_newline_index_note(fsp_context *ctx, const char *data, size_t length)
+{
+  size_t i = 0;
+
+  while(i < length) {
+    size_t at = fsp_scan_delims(data + i, length - i, '\n', -1);
+
+    i += at;
+    if(i >= length)
+      break;
+
+    if(ctx->newline_count == ctx->newline_capacity) {
+      size_t new_capacity = ctx->newline_capacity ?
+                            ctx->newline_capacity * 2 : 64;
+      size_t *new_offsets = FSP_REALLOC(size_t*, ctx->newline_offsets,
+                                        new_capacity * sizeof(size_t));
+      if(!new_offsets)
+        return -1;
+
+      ctx->newline_offsets = new_offsets;
+      ctx->newline_capacity = new_capacity;
+    }
+
+    ctx->newline_offsets[ctx->newline_count++] =
+      ctx->newline_stream_length + i;
+    i++;
+  }
+
+  ctx->newline_stream_length += length;
+
+  return 0;
+}
+
+
+/**
+ * fsp_get_stats - Copy out the context's hot-path counters
+ *
+ * @ctx: The context to read the counters from
+ * @stats: Filled in with a snapshot of the counters
+ */
+void
+fsp_get_stats(fsp_context *ctx, fsp_stats *stats)
+{
+  if(!ctx || !stats)
+    return;
+
+  *stats = ctx->stats;
+}
+
+
+/* Reset a context to its freshly-created state, keeping the grown
+ * stream buffer and chunk reference array allocations */
+static void
+fsp_context_clear(fsp_context *ctx)
+{
+  fsp_config_init(&ctx->config);
+  memset(&ctx->stats, '\0', sizeof(ctx->stats));
+  ctx->stats.peak_buffer_capacity = ctx->buffer_capacity;
+
+  ctx->parser_state = NULL;
+  ctx->parser_status = 0;
+  ctx->lexer_scanner = NULL;
+  ctx->data_length = 0;
+  ctx->read_position = 0;
+  ctx->ring_mode = 0;
+  ctx->keep_from = (size_t)-1;
+  ctx->stream_consumed = 0;
+  ctx->spill_fd = -1;
+  ctx->spill_length = 0;
+  ctx->spill_read = 0;
+  ctx->io_fd = -1;
+  ctx->chunk_refs_count = 0;
+  ctx->chunk_refs_head = 0;
+  ctx->spsc_mode = 0;
+  ctx->spsc_write_position = 0;
+  ctx->spsc_read_position = 0;
+  ctx->input_filter = FSP_FILTER_NONE;
+  ctx->filter_state = NULL;
+  ctx->filter_at_end = 0;
+  ctx->filter_saw_input = 0;
+  ctx->newline_index_enabled = 0;
+  ctx->newline_suppress = 0;
+  ctx->newline_count = 0;
+  ctx->newline_stream_length = 0;
+  ctx->more_chunks_expected = 1;
+  ctx->initialization_done = 0;
+  ctx->parser_driver = NULL;
+  ctx->parser_driver_user_data = NULL;
+  ctx->reset_handler = NULL;
+  ctx->reset_handler_user_data = NULL;
+  ctx->high_watermark = 0;
+  ctx->low_watermark = 0;
+  ctx->drain_callback = NULL;
+  ctx->drain_callback_user_data = NULL;
+  ctx->backpressured = 0;
+  ctx->user_data = NULL;
+  ctx->pool_next = NULL;
+  ctx->sched = NULL;
+  ctx->sched_registered_next = NULL;
+  ctx->sched_registered_prev = NULL;
+  ctx->sched_ready_next = NULL;
+  ctx->sched_ready = 0;
+#ifdef FSP_TRACE
+  ctx->trace_records = NULL;
+  ctx->trace_capacity = 0;
+  ctx->trace_write = 0;
+  ctx->trace_read = 0;
+  ctx->trace_sequence = 0;
+#endif
+}
+
+
+/**
+ * fsp_set_context_pool_size - Enable recycling of destroyed contexts
+ *
+ * @max_contexts: Maximum contexts to keep pooled; 0 disables pooling
+ *
+ * With pooling enabled fsp_destroy() parks up to @max_contexts contexts
+ * on a freelist instead of freeing them, and fsp_create() pops from the
+ * freelist, making steady-state create/destroy cycles allocation-free.
+ * Shrinking the pool frees the excess contexts.  Not thread-safe.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_set_context_pool_size(size_t max_contexts)
+{
+  fsp_context *ctx;
+
+  fsp_context_pool_max = max_contexts;
+
+  /* Free any pooled contexts above the new limit */
+  while(fsp_context_pool_count > fsp_context_pool_max) {
+    ctx = fsp_context_pool_head;
+    fsp_context_pool_head = ctx->pool_next;
+    fsp_context_pool_count--;
+
+    ctx->pool_next = NULL;
+    if(ctx->stream_buffer && ctx->stream_buffer != ctx->inline_buffer)
+      FSP_FREE(char*, ctx->stream_buffer);
+    if(ctx->chunk_refs)
+      FSP_FREE(fsp_chunk_ref*, ctx->chunk_refs);
+    if(ctx->newline_offsets)
+      FSP_FREE(size_t*, ctx->newline_offsets);
+    FSP_FREE(fsp_context*, ctx);
+  }
+
+  return 0;
+}
+
+
+/**
+ * fsp_config_init - Initialize a configuration with the default policy
+ *
+ * @config: The configuration to initialize
+ *
+ * Defaults match fsp_create(): 64KB initial capacity, doubling growth,
+ * no ceiling and no shrinking.
+ */
+void
+fsp_config_init(fsp_config *config)
+{
+  if(!config)
+    return;
+
+  memset(config, '\0', sizeof(*config));
+  config->initial_buffer_size = FSP_DEFAULT_BUFFER_SIZE;
+  config->growth_factor = 2;
+}
+
+
+/**
+ * fsp_create_with_config - Create a context with an explicit buffer policy
+ *
+ * @config: Buffer sizing and growth policy, or NULL for the defaults
+ *
+ * Returns:
+ *   A new fsp_context, or NULL if memory allocation fails
+ */
+fsp_context*
+fsp_create_with_config(const fsp_config *config)
+{
+  fsp_context *ctx;
+
+  ctx = FSP_CALLOC(fsp_context*, 1, sizeof(fsp_context));
+  if(!ctx)
+    return NULL;
+
+  if(config)
+    ctx->config = *config;
+  else
+    fsp_config_init(&ctx->config);
+
+  /* Adaptive policy: start at the learned percentile of observed
+   * backlogs, falling back to the default until samples accumulate */
+  if(ctx->config.initial_buffer_size == FSP_SIZE_ADAPTIVE)
+    ctx->config.initial_buffer_size = fsp_adaptive_size();
+
+  if(!ctx->config.initial_buffer_size)
+    ctx->config.initial_buffer_size = FSP_DEFAULT_BUFFER_SIZE;
+  if(!ctx->config.growth_factor)
+    ctx->config.growth_factor = 2;
+  if(ctx->config.max_buffer_size &&
+     ctx->config.initial_buffer_size > ctx->config.max_buffer_size)
+    ctx->config.initial_buffer_size = ctx->config.max_buffer_size;
+
+  /* Small-document fast path: start in the embedded inline buffer and
+   * defer the heap allocation until growth actually needs it.  The
+   * configured size still caps the starting capacity so sizing
+   * contracts (e.g. the SPSC ring) hold. */
+  ctx->buffer_capacity = ctx->config.initial_buffer_size;
+  if(ctx->buffer_capacity > FSP_INLINE_BUFFER_SIZE)
+    ctx->buffer_capacity = FSP_INLINE_BUFFER_SIZE;
+  ctx->stream_buffer = ctx->inline_buffer;
+
+  ctx->data_length = 0;
+  ctx->read_position = 0;
+  ctx->keep_from = (size_t)-1;
+  ctx->spill_fd = -1;
+  ctx->io_fd = -1;
+  ctx->more_chunks_expected = 1;
+  ctx->initialization_done = 0;
+  ctx->stats.peak_buffer_capacity = ctx->buffer_capacity;
+
+  return ctx;
+}
+
+
+/**
+ * fsp_create - Create a new streaming parser context
+ *
+ * Returns:
+ *   A new fsp_context, or NULL if memory allocation fails
+ */
+fsp_context*
+fsp_create(void)
+{
+  fsp_context *ctx;
+
+  /* Pop a pre-sized context from the pool when available */
+  if(fsp_context_pool_head) {
+    ctx = fsp_context_pool_head;
+    fsp_context_pool_head = ctx->pool_next;
+    fsp_context_pool_count--;
+
+    fsp_context_clear(ctx);
+    return ctx;
+  }
+
+  return fsp_create_with_config(NULL);
+}
+
+
+static int fsp_buffer_append_raw(fsp_context *ctx, const char *data,
+                                 size_t length);
+static void fsp_ring_copy_out(fsp_context *ctx, char *dst, size_t count);
+static void fsp_release_mapping(fsp_context *ctx);
+
+
+/* Compute the next buffer capacity able to hold @needed bytes under
+ * the context's growth policy; returns 0 when @needed exceeds the
+ * configured hard ceiling */
+static size_t
+fsp_next_capacity(fsp_context *ctx, size_t needed)
+{
+  size_t new_capacity = ctx->buffer_capacity;
+  size_t factor = ctx->config.growth_factor ? ctx->config.growth_factor : 2;
+
+  if(ctx->config.max_buffer_size && needed > ctx->config.max_buffer_size)
+    return 0;
+
+  while(new_capacity < needed) {
+    if(ctx->config.growth_increment)
+      new_capacity += ctx->config.growth_increment;
+    else
+      new_capacity *= factor;
+  }
+
+  if(ctx->config.max_buffer_size &&
+     new_capacity > ctx->config.max_buffer_size)
+    new_capacity = ctx->config.max_buffer_size;
+
+  return new_capacity;
+}
+
+
+/* Resize the stream buffer to @new_capacity bytes preserving the
+ * stored bytes (data_length), promoting out of the embedded inline
+ * buffer on the first heap growth.  The promotion jumps straight to
+ * the configured initial size so the growth curve from there matches
+ * a heap-allocated start */
+static int
+fsp_buffer_set_capacity(fsp_context *ctx, size_t new_capacity)
+{
+  char *new_buffer;
+
+  if(ctx->stream_buffer == ctx->inline_buffer) {
+    if(new_capacity <= FSP_INLINE_BUFFER_SIZE) {
+      /* Still fits in the inline storage - just raise the cap */
+      ctx->buffer_capacity = new_capacity;
+      return 0;
+    }
+
+    if(new_capacity < ctx->config.initial_buffer_size)
+      new_capacity = ctx->config.initial_buffer_size;
+
+    new_buffer = FSP_MALLOC(char*, new_capacity);
+    if(!new_buffer)
+      return -1; /* Out of memory */
+    memcpy(new_buffer, ctx->stream_buffer, ctx->data_length);
+  } else {
+    new_buffer = FSP_REALLOC(char*, ctx->stream_buffer, new_capacity);
+    if(!new_buffer)
+      return -1; /* Out of memory */
+  }
+
+  ctx->stream_buffer = new_buffer;
+  ctx->buffer_capacity = new_capacity;
+  return 0;
+}
+
+
+/* Grow a ring-mode buffer so it can hold @needed more unread bytes,
+ * linearizing into a fresh buffer; no-op when it already fits */
+static int
+fsp_ring_grow(fsp_context *ctx, size_t needed)
+{
+  size_t unread = ctx->data_length;
+  size_t new_capacity;
+  char *new_buffer;
+
+  if(unread + needed <= ctx->buffer_capacity)
+    return 0;
+
+  new_capacity = fsp_next_capacity(ctx, unread + needed);
+  if(!new_capacity)
+    return -1; /* Over the configured ceiling */
+
+  if(ctx->stream_buffer == ctx->inline_buffer &&
+     new_capacity < ctx->config.initial_buffer_size)
+    new_capacity = ctx->config.initial_buffer_size;
+
+  new_buffer = FSP_MALLOC(char*, new_capacity);
+  if(!new_buffer)
+    return -1; /* Out of memory */
+
+  fsp_ring_copy_out(ctx, new_buffer, unread);
+  if(ctx->stream_buffer != ctx->inline_buffer)
+    FSP_FREE(char*, ctx->stream_buffer);
+  ctx->stream_buffer = new_buffer;
+  ctx->buffer_capacity = new_capacity;
+  ctx->read_position = 0;
+
+  ctx->stats.buffer_grows++;
+  if(new_capacity > ctx->stats.peak_buffer_capacity)
+    ctx->stats.peak_buffer_capacity = new_capacity;
+
+  return 0;
+}
+
+
+/* Move the unread bytes of a ring-mode buffer to offset 0 so they are
+ * contiguous; read_position becomes 0 */
+static int
+fsp_ring_linearize(fsp_context *ctx)
+{
+  size_t unread = ctx->data_length;
+  char *temp;
+
+  if(ctx->read_position == 0)
+    return 0;
+
+  if(ctx->read_position + unread <= ctx->buffer_capacity) {
+    /* Not wrapped - a single move suffices */
+    if(unread > 0)
+      memmove(ctx->stream_buffer, ctx->stream_buffer + ctx->read_position,
+              unread);
+  } else {
+    /* Wrapped - stitch the two segments together via a scratch copy */
+    temp = FSP_MALLOC(char*, unread);
+    if(!temp)
+      return -1;
+
+    fsp_ring_copy_out(ctx, temp, unread);
+    memcpy(ctx->stream_buffer, temp, unread);
+    FSP_FREE(char*, temp);
+  }
+
+  ctx->read_position = 0;
+  return 0;
+}
+
+
+/* Copy the first @count unread bytes out of a ring-mode buffer into
+ * @dst in stream order, handling the at-most-one wrap split */
+static void
+fsp_ring_copy_out(fsp_context *ctx, char *dst, size_t count)
+{
+  size_t first = ctx->buffer_capacity - ctx->read_position;
+
+  if(first > count)
+    first = count;
+
+  memcpy(dst, ctx->stream_buffer + ctx->read_position, first);
+  if(count > first)
+    memcpy(dst + first, ctx->stream_buffer, count - first);
+}
+
+/**
+ * fsp_reset - Reset a context for reuse on a new document
+ *
+ * @ctx: The context to reset
+ *
+ * Rewinds the streaming state so the context can parse another
+ * document without a destroy/create round trip: the stream buffer
+ * allocation (including any growth) is kept, pending data and borrowed
+ * chunk references are dropped, and the EOF/initialization flags are
+ * rearmed.  If a reset handler was installed with
+ * fsp_set_reset_handler() it is invoked last so the host can
+ * reinitialize its push parser state and lexer scanner.
+ *
+ * Returns: 0 on success, non-zero on failure (from the reset handler)
+ */
+int
+fsp_reset(fsp_context *ctx)
+{
+  if(!ctx)
+    return -1;
+
+  fsp_release_mapping(ctx);
+
+  ctx->data_length = 0;
+  ctx->read_position = 0;
+  ctx->keep_from = (size_t)-1;
+  ctx->stream_consumed = 0;
+  ctx->chunk_refs_count = 0;
+  ctx->chunk_refs_head = 0;
+
+#ifdef FSP_HAVE_SPILL
+  /* Drop any spilled backlog but keep the file open for reuse */
+  if(ctx->spill_fd >= 0) {
+    if(ftruncate(ctx->spill_fd, 0) == 0)
+      (void)lseek(ctx->spill_fd, 0, SEEK_SET);
+  }
+#endif
+  ctx->spill_length = 0;
+  ctx->spill_read = 0;
+  ctx->spsc_write_position = 0;
+  ctx->spsc_read_position = 0;
+  ctx->newline_count = 0;
+  ctx->newline_stream_length = 0;
+  ctx->parser_status = 0;
+  ctx->more_chunks_expected = 1;
+  ctx->initialization_done = 0;
+  /* Backlog was just dropped; no drain callback for a reset */
+  ctx->backpressured = 0;
+
+  /* A selected input filter stays installed; rearm its decompressor
+   * for the next document's compressed stream */
+  if(ctx->filter_state) {
+#ifdef HAVE_ZLIB_H
+    if(ctx->input_filter == FSP_FILTER_GZIP)
+      (void)inflateReset((z_stream*)ctx->filter_state);
+#endif
+#ifdef HAVE_ZSTD_H
+    if(ctx->input_filter == FSP_FILTER_ZSTD)
+      (void)ZSTD_initDStream((ZSTD_DStream*)ctx->filter_state);
+#endif
+    ctx->filter_at_end = 0;
+    ctx->filter_saw_input = 0;
+  }
+
+  if(ctx->reset_handler)
+    return ctx->reset_handler(ctx, ctx->reset_handler_user_data);
+
+  return 0;
+}
+
+
+/**
+ * fsp_set_reset_handler - Install a host hook invoked by fsp_reset()
+ *
+ * @ctx: The context to set the handler for
+ * @handler: The handler, or NULL to remove it
+ * @user_data: Opaque pointer passed to the handler
+ */
+void
+fsp_set_reset_handler(fsp_context *ctx, fsp_reset_handler handler,
+                      void *user_data)
+{
+  if(!ctx)
+    return;
+
+  ctx->reset_handler = handler;
+  ctx->reset_handler_user_data = user_data;
+}
+
+
+/* Count unconsumed bytes held in borrowed chunk references */
+static size_t
+fsp_chunk_refs_available(fsp_context *ctx)
+{
+  size_t available = 0;
+  size_t i;
+
+  for(i = ctx->chunk_refs_head; i < ctx->chunk_refs_count; i++)
+    available += ctx->chunk_refs[i].length - ctx->chunk_refs[i].consumed;
+
+  return available;
+}
+
+
+/* Record a borrowed chunk reference; the bytes are not copied */
+static int
+fsp_chunk_refs_push(fsp_context *ctx, const char *data, size_t length)
+{
+  size_t new_capacity;
+  fsp_chunk_ref *new_refs;
+
+  /* Borrowed references are served by the consumer thread but pushed
+   * by the producer; not safe in the SPSC handoff mode */
+  if(ctx->spsc_mode)
+    return -1;
+
+  /* With a keep mark set (fsp_set_keep_from) retained bytes must
+   * outlive the caller's chunk: fall back to copying through the
+   * stream buffer (fsp_buffer_append() spills any pending references
+   * first, preserving byte order).  Likewise while backlog sits in the
+   * spill file, where new bytes must follow it. */
+  if(ctx->keep_from != (size_t)-1 || ctx->spill_read < ctx->spill_length)
+    return fsp_buffer_append(ctx, data, length);
+
+  /* Recycle the array once every pending reference is fully consumed */
+  if(ctx->chunk_refs_head == ctx->chunk_refs_count) {
+    ctx->chunk_refs_head = 0;
+    ctx->chunk_refs_count = 0;
+  }
+
+  if(ctx->chunk_refs_count == ctx->chunk_refs_capacity) {
+    new_capacity = ctx->chunk_refs_capacity ? ctx->chunk_refs_capacity * 2 : 8;
+    new_refs = FSP_REALLOC(fsp_chunk_ref*, ctx->chunk_refs,
+                           new_capacity * sizeof(*new_refs));
+    if(!new_refs)
+      return -1;
+
+    ctx->chunk_refs = new_refs;
+    ctx->chunk_refs_capacity = new_capacity;
+  }
+
+  if(ctx->newline_index_enabled) {
+    if(fsp_newline_index_note(ctx, data, length) < 0)
+      return -1;
+  }
+
+  ctx->chunk_refs[ctx->chunk_refs_count].data = data;
+  ctx->chunk_refs[ctx->chunk_refs_count].length = length;
+  ctx->chunk_refs[ctx->chunk_refs_count].consumed = 0;
+  ctx->chunk_refs_count++;
+
+  return 0;
+}
+
+
+/* Copy-and-stitch fallback: move unconsumed borrowed bytes into
+ * stream_buffer so that a copying append can follow them without
+ * reordering the stream.  Drops all pending references. */
+static int
+fsp_chunk_refs_spill(fsp_context *ctx)
+{
+  size_t i;
+
+  /* These bytes were indexed when first pushed; do not index again */
+  ctx->newline_suppress = 1;
+
+  for(i = ctx->chunk_refs_head; i < ctx->chunk_refs_count; i++) {
+    fsp_chunk_ref *ref = &ctx->chunk_refs[i];
+
+    if(ref->consumed < ref->length) {
+      if(fsp_buffer_append_raw(ctx, ref->data + ref->consumed,
+                               ref->length - ref->consumed) < 0) {
+        ctx->newline_suppress = 0;
+        return -1;
+      }
+      ref->consumed = ref->length;
+    }
+  }
+
+  ctx->newline_suppress = 0;
+  ctx->chunk_refs_head = 0;
+  ctx->chunk_refs_count = 0;
+
+  return 0;
+}
+
+
+/* Release any file mapping held by the context */
+static void
+fsp_release_mapping(fsp_context *ctx)
+{
+  if(!ctx->file_mapping)
+    return;
+
+#ifdef HAVE_SYS_MMAN_H
+  munmap(ctx->file_mapping, ctx->file_mapping_length);
+#endif
+  ctx->file_mapping = NULL;
+  ctx->file_mapping_length = 0;
+}
+
+
+/* Release the decompressor state of the selected input filter, if any,
+ * and return the context to the unfiltered default */
+static void
+fsp_filter_teardown(fsp_context *ctx)
+{
+  if(ctx->filter_state) {
+#ifdef HAVE_ZLIB_H
+    if(ctx->input_filter == FSP_FILTER_GZIP) {
+      inflateEnd((z_stream*)ctx->filter_state);
+      FSP_FREE(z_stream*, ctx->filter_state);
+    }
+#endif
+#ifdef HAVE_ZSTD_H
+    if(ctx->input_filter == FSP_FILTER_ZSTD)
+      ZSTD_freeDStream((ZSTD_DStream*)ctx->filter_state);
+#endif
+    ctx->filter_state = NULL;
+  }
+
+  ctx->input_filter = FSP_FILTER_NONE;
+  ctx->filter_at_end = 0;
+  ctx->filter_saw_input = 0;
+}
+
+
+/* Decompress @data straight into reserved stream buffer space; append
+ * glue shared by the parse entry points when an input filter is set */
+static int
+fsp_filter_append(fsp_context *ctx, const char *data, size_t length)
+{
+  if(length > 0)
+    ctx->filter_saw_input = 1;
+
+#ifdef HAVE_ZLIB_H
+  if(ctx->input_filter == FSP_FILTER_GZIP) {
+    z_stream *strm = (z_stream*)ctx->filter_state;
+
+    strm->next_in = (Bytef*)data;
+    strm->avail_in = (uInt)length;
+
+    while(strm->avail_in > 0) {
+      char *out;
+      size_t available;
+      size_t produced;
+      int rc;
+
+      /* A new gzip member may follow a finished one (concatenation) */
+      if(ctx->filter_at_end) {
+        if(inflateReset(strm) != Z_OK)
+          return -1;
+        ctx->filter_at_end = 0;
+      }
+
+      if(fsp_buffer_reserve(ctx, FSP_FILTER_MIN_OUTPUT, &out,
+                            &available) < 0)
+        return -1;
+      if(available > (size_t)(uInt)-1)
+        available = (size_t)(uInt)-1;
+
+      strm->next_out = (Bytef*)out;
+      strm->avail_out = (uInt)available;
+
+      rc = inflate(strm, Z_NO_FLUSH);
+      if(rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+        return -1; /* Corrupt stream (or a zlib internal failure) */
+
+      produced = available - strm->avail_out;
+      if(produced > 0 && fsp_buffer_commit(ctx, produced) < 0)
+        return -1;
+
+      if(rc == Z_STREAM_END)
+        ctx->filter_at_end = 1;
+      else if(rc == Z_BUF_ERROR && produced == 0)
+        break; /* No forward progress without more input */
+    }
+
+    return 0;
+  }
+#endif
+
+#ifdef HAVE_ZSTD_H
+  if(ctx->input_filter == FSP_FILTER_ZSTD) {
+    ZSTD_DStream *dstream = (ZSTD_DStream*)ctx->filter_state;
+    ZSTD_inBuffer input;
+
+    input.src = data;
+    input.size = length;
+    input.pos = 0;
+
+    while(input.pos < input.size) {
+      char *out;
+      size_t available;
+      ZSTD_outBuffer output;
+      size_t rc;
+
+      if(fsp_buffer_reserve(ctx, FSP_FILTER_MIN_OUTPUT, &out,
+                            &available) < 0)
+        return -1;
+
+      output.dst = out;
+      output.size = available;
+      output.pos = 0;
+
+      rc = ZSTD_decompressStream(dstream, &output, &input);
+      if(ZSTD_isError(rc))
+        return -1;
+
+      if(output.pos > 0 && fsp_buffer_commit(ctx, output.pos) < 0)
+        return -1;
+
+      /* rc == 0 marks a completed frame; another may follow */
+      ctx->filter_at_end = (rc == 0);
+    }
+
+    return 0;
+  }
+#endif
+
+#if !defined(HAVE_ZLIB_H) && !defined(HAVE_ZSTD_H)
+  (void)data;
+#endif
+
+  /* Unreachable: fsp_set_input_filter() refuses unbuilt filters */
+  return -1;
+}
+
+
+/**
+ * fsp_destroy - Destroy a streaming parser context
+ *
+ * @ctx: The context to destroy
+ */
+void
+fsp_destroy(fsp_context *ctx)
+{
+  if(!ctx)
+    return;
+
+  fsp_release_mapping(ctx);
+  fsp_filter_teardown(ctx);
+  fsp_adaptive_note(ctx);
+
+#ifdef FSP_HAVE_SPILL
+  if(ctx->spill_fd >= 0) {
+    close(ctx->spill_fd);
+    ctx->spill_fd = -1;
+  }
+#endif
+  ctx->spill_length = 0;
+  ctx->spill_read = 0;
+
+#ifdef FSP_TRACE
+  /* The trace ring is per-session, not per-context-allocation: release
+   * it even when the context itself is pooled for reuse */
+  if(ctx->trace_records) {
+    FSP_FREE(fsp_trace_record*, ctx->trace_records);
+    ctx->trace_records = NULL;
+    ctx->trace_capacity = 0;
+  }
+#endif
+
+  /* Park the context on the pool freelist when there is room */
+  if(fsp_context_pool_count < fsp_context_pool_max) {
+    ctx->pool_next = fsp_context_pool_head;
+    fsp_context_pool_head = ctx;
+    fsp_context_pool_count++;
+    return;
+  }
+
+  if(ctx->stream_buffer) {
+    if(ctx->stream_buffer != ctx->inline_buffer)
+      FSP_FREE(char*, ctx->stream_buffer);
+    ctx->stream_buffer = NULL;
+  }
+
+  if(ctx->chunk_refs) {
+    FSP_FREE(fsp_chunk_ref*, ctx->chunk_refs);
+    ctx->chunk_refs = NULL;
+  }
+
+  if(ctx->newline_offsets) {
+    FSP_FREE(size_t*, ctx->newline_offsets);
+    ctx->newline_offsets = NULL;
+  }
+
+  FSP_FREE(fsp_context*, ctx);
+}
+
+
+/**
+ * fsp_read_input - Read input data from the context
+ *
+ * @user_data: User data pointer
+ * @buffer: Buffer to fill with data
+ * @max_size: Maximum bytes to read
+ *
+ * Returns: Number of bytes read, or 0 for EOF
+ */
+int
+fsp_read_input(void *user_data, char *buffer, size_t max_size)
+{
+  fsp_context *ctx = (fsp_context*)user_data;
+  size_t available;
+  size_t to_copy;
+  size_t copied = 0;
+
+  if(!ctx || !buffer || max_size == 0)
+    return 0;
+
+#ifdef FSP_HAVE_ATOMICS
+  if(ctx->spsc_mode) {
+    /* Consumer side of the SPSC ring: only this thread moves
+     * spsc_read_position; the producer's index is read once with
+     * acquire ordering so the bytes it published are visible */
+    size_t read_position = ctx->spsc_read_position;
+    size_t write_position = FSP_ATOMIC_LOAD(&ctx->spsc_write_position);
+    size_t first;
+
+    available = (write_position + ctx->buffer_capacity - read_position) %
+                ctx->buffer_capacity;
+
+    if(available > 0) {
+      to_copy = (available < max_size) ? available : max_size;
+
+      first = ctx->buffer_capacity - read_position;
+      if(first > to_copy)
+        first = to_copy;
+
+      memcpy(buffer, ctx->stream_buffer + read_position, first);
+      if(to_copy > first)
+        memcpy(buffer + first, ctx->stream_buffer, to_copy - first);
+
+      FSP_ATOMIC_STORE(&ctx->spsc_read_position,
+                       (read_position + to_copy) % ctx->buffer_capacity);
+      /* Consumed ring bytes are gone; keep the stream coordinate of
+       * the buffer start current for a later return to linear mode */
+      ctx->stream_consumed += to_copy;
+      copied = to_copy;
+    }
+
+    /* Consumer-owned counters only; the producer owns bytes_appended */
+    if(copied == 0)
+      ctx->stats.read_stalls++;
+    ctx->stats.bytes_read += copied;
+
+    FSP_TRACE_EVENT(ctx, FSP_TRACE_READ, copied);
+    return (int)copied;
+  }
+#endif
+
+  if(ctx->ring_mode) {
+    /* Circular buffer: serve up to max_size bytes with at most one
+     * wrap split, then reclaim the space by advancing the ring start */
+    available = ctx->data_length;
+
+    if(available > 0) {
+      to_copy = (available < max_size) ? available : max_size;
+      fsp_ring_copy_out(ctx, buffer, to_copy);
+      ctx->read_position = (ctx->read_position + to_copy) % ctx->buffer_capacity;
+      ctx->data_length -= to_copy;
+      ctx->stream_consumed += to_copy;
+      copied = to_copy;
+    }
+  } else {
+    /* Calculate available unread data in the stream buffer */
+    available = ctx->data_length - ctx->read_position;
+
+    if(available > 0) {
+      /* Copy available data to caller's buffer */
+      to_copy = (available < max_size) ? available : max_size;
+      memcpy(buffer, ctx->stream_buffer + ctx->read_position, to_copy);
+      ctx->read_position += to_copy;
+      copied = to_copy;
+    }
+  }
+
+#ifdef FSP_HAVE_SPILL
+  /* Fault spilled backlog back in, sequentially, straight into the
+   * caller's buffer; the file bytes are older than any borrowed
+   * references.  The buffered bytes are fully drained at this point,
+   * so retire the dead region to keep stream_consumed (the stream
+   * offset of stream_buffer[0]) current */
+  if(copied < max_size && ctx->spill_read < ctx->spill_length) {
+    ctx->stream_consumed += ctx->data_length;
+    ctx->data_length = 0;
+    ctx->read_position = 0;
+
+    while(copied < max_size && ctx->spill_read < ctx->spill_length) {
+      size_t want = max_size - copied;
+      ssize_t faulted;
+
+      if(want > ctx->spill_length - ctx->spill_read)
+        want = ctx->spill_length - ctx->spill_read;
+
+      faulted = pread(ctx->spill_fd, buffer + copied, want,
+                      (off_t)ctx->spill_read);
+      if(faulted <= 0)
+        break; /* Short read: serve what we have, retry next call */
+
+      ctx->spill_read += (size_t)faulted;
+      ctx->stream_consumed += (size_t)faulted;
+      copied += (size_t)faulted;
+    }
+
+    /* Fully drained: rewind the file so its space is reused */
+    if(ctx->spill_read == ctx->spill_length) {
+      ctx->spill_length = 0;
+      ctx->spill_read = 0;
+      if(ftruncate(ctx->spill_fd, 0) == 0)
+        (void)lseek(ctx->spill_fd, 0, SEEK_SET);
+    }
+  }
+#endif
+
+  /* Serve directly from borrowed chunk references (zero-copy mode);
+   * the stream buffer always holds the older bytes so it drains first.
+   * Borrowed bytes never enter the buffer, so retire the (now fully
+   * consumed) buffer contents and count the borrowed bytes to keep
+   * stream_consumed tracking the stream offset of stream_buffer[0] */
+  if(copied < max_size && ctx->chunk_refs_head < ctx->chunk_refs_count &&
+     !ctx->ring_mode) {
+    ctx->stream_consumed += ctx->data_length;
+    ctx->data_length = 0;
+    ctx->read_position = 0;
+  }
+  while(copied < max_size && ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    fsp_chunk_ref *ref = &ctx->chunk_refs[ctx->chunk_refs_head];
+    size_t remaining = ref->length - ref->consumed;
+
+    if(remaining == 0) {
+      ctx->chunk_refs_head++;
+      continue;
+    }
+
+    to_copy = max_size - copied;
+    if(to_copy > remaining)
+      to_copy = remaining;
+
+    memcpy(buffer + copied, ref->data + ref->consumed, to_copy);
+    ref->consumed += to_copy;
+    ctx->stream_consumed += to_copy;
+    copied += to_copy;
+  }
+
+  /* copied == 0 here means either "would block" (more chunks coming)
+   * or true EOF; both are signalled to the lexer as a zero read */
+  if(copied == 0)
+    ctx->stats.read_stalls++;
+  ctx->stats.bytes_read += copied;
+
+  /* Backpressure: once a refused producer's backlog drains to the low
+   * watermark, tell the host it may resume reading its socket */
+  if(ctx->backpressured && fsp_buffer_available(ctx) <= ctx->low_watermark) {
+    ctx->backpressured = 0;
+    if(ctx->drain_callback)
+      ctx->drain_callback(ctx, ctx->drain_callback_user_data);
+  }
+
+  FSP_TRACE_EVENT(ctx, FSP_TRACE_READ, copied);
+  return (int)copied;
+}
+
+
+#ifdef FSP_HAVE_SPILL
+/* Append bytes to the per-context spill file, creating it (already
+ * unlinked) on first use */
+static int
+fsp_spill_write(fsp_context *ctx, const char *data, size_t length)
+{
+  if(ctx->spill_fd < 0) {
+    char path[] = "/tmp/fsp-spill-XXXXXX";
+    int fd = mkstemp(path);
+
+    if(fd < 0)
+      return -1;
+    /* Anonymous from the start: the space is reclaimed even on crash */
+    unlink(path);
+    ctx->spill_fd = fd;
+  }
+
+  while(length > 0) {
+    ssize_t written = write(ctx->spill_fd, data, length);
+
+    if(written < 0) {
+      if(errno == EINTR)
+        continue;
+      return -1;
+    }
+    if(written == 0)
+      return -1;
+
+    data += written;
+    length -= (size_t)written;
+    ctx->spill_length += (size_t)written;
+    ctx->stats.bytes_appended += (size_t)written;
+  }
+
+  return 0;
+}
+#endif
+
+
+/* Buffer offset up to which compaction may discard: normally the read
+ * position, pulled back to the host's keep mark (fsp_set_keep_from)
+ * when one points at earlier bytes still referenced by an in-progress
+ * token */
+static size_t
+fsp_keep_position(fsp_context *ctx)
+{
+  size_t discard = ctx->read_position;
+
+  if(ctx->keep_from != (size_t)-1) {
+    if(ctx->keep_from <= ctx->stream_consumed)
+      discard = 0;
+    else if(ctx->keep_from - ctx->stream_consumed < discard)
+      discard = ctx->keep_from - ctx->stream_consumed;
+  }
+
+  return discard;
+}
+
+
+/* Append data to stream_buffer without touching borrowed chunk
+ * references; shared by fsp_buffer_append() and fsp_chunk_refs_spill() */
+static int
+fsp_buffer_append_raw(fsp_context *ctx, const char *data, size_t length)
+{
+  size_t unread;
+  size_t new_capacity;
+  size_t write_position;
+  size_t first;
+
+#ifdef FSP_HAVE_ATOMICS
+  if(ctx->spsc_mode) {
+    /* Producer side of the SPSC ring: only this thread moves
+     * spsc_write_position, and the capacity is fixed while the mode is
+     * enabled so the consumer never sees a stale buffer pointer.  One
+     * slot stays empty to distinguish full from empty. */
+    size_t producer_position = ctx->spsc_write_position;
+    size_t consumer_position = FSP_ATOMIC_LOAD(&ctx->spsc_read_position);
+    size_t used = (producer_position + ctx->buffer_capacity -
+                   consumer_position) % ctx->buffer_capacity;
+
+    if(length > ctx->buffer_capacity - 1 - used)
+      return -1; /* Ring full - retry after the consumer drains */
+
+    first = ctx->buffer_capacity - producer_position;
+    if(first > length)
+      first = length;
+
+    memcpy(ctx->stream_buffer + producer_position, data, first);
+    if(length > first)
+      memcpy(ctx->stream_buffer, data + first, length - first);
+
+    FSP_ATOMIC_STORE(&ctx->spsc_write_position,
+                     (producer_position + length) % ctx->buffer_capacity);
+
+    /* Producer-owned counters only; the consumer owns bytes_read */
+    ctx->stats.bytes_appended += length;
+    if(used + length > ctx->stats.peak_unread)
+      ctx->stats.peak_unread = used + length;
+
+    return 0;
+  }
+#endif
+
+  /* Index newlines in the new bytes before any copying can fail */
+  if(ctx->newline_index_enabled && !ctx->newline_suppress) {
+    if(fsp_newline_index_note(ctx, data, length) < 0)
+      return -1;
+  }
+
+  if(ctx->ring_mode) {
+    /* Grow by linearizing into a fresh buffer; no memmove compaction
+     * is ever needed since consumed space is reclaimed on read */
+    if(fsp_ring_grow(ctx, length) < 0)
+      return -1;
+
+    unread = ctx->data_length;
+
+    /* Write at the ring end with at most one wrap split */
+    write_position = (ctx->read_position + unread) % ctx->buffer_capacity;
+    first = ctx->buffer_capacity - write_position;
+    if(first > length)
+      first = length;
+
+    memcpy(ctx->stream_buffer + write_position, data, first);
+    if(length > first)
+      memcpy(ctx->stream_buffer, data + first, length - first);
+
+    ctx->data_length = unread + length;
+
+    ctx->stats.bytes_appended += length;
+    fsp_stats_note_unread(ctx);
+    FSP_TRACE_EVENT(ctx, FSP_TRACE_APPEND, length);
+    return 0;
+  }
+
+#ifdef FSP_HAVE_SPILL
+  /* Overflow mode: cap the unread backlog held in RAM and send the
+   * rest to the spill file.  Once any bytes have spilled, later
+   * appends must follow them to preserve stream order.  A keep mark
+   * (fsp_set_keep_from) pins bytes in RAM and suspends spilling. */
+  if(ctx->config.spill_threshold && ctx->keep_from == (size_t)-1) {
+    if(ctx->spill_read < ctx->spill_length ||
+       (ctx->data_length - ctx->read_position) + length >
+         ctx->config.spill_threshold)
+      return fsp_spill_write(ctx, data, length);
+  }
+#endif
+
+  /* Check if we need to grow or compact buffer */
+  if(ctx->data_length + length > ctx->buffer_capacity) {
+    /* Compact buffer (move unread and kept data to beginning) */
+    size_t discard = fsp_keep_position(ctx);
+
+    unread = ctx->data_length - discard;
+    if(unread > 0 && discard > 0) {
+      memmove(ctx->stream_buffer,
+              ctx->stream_buffer + discard,
+              unread);
+      ctx->stats.compactions++;
+      ctx->stats.compaction_bytes_moved += unread;
+      FSP_TRACE_EVENT(ctx, FSP_TRACE_COMPACT, unread);
+    }
+    ctx->data_length = unread;
+    ctx->read_position -= discard;
+    ctx->stream_consumed += discard;
+
+    /* If still not enough space, grow buffer */
+    if(ctx->data_length + length > ctx->buffer_capacity) {
+      new_capacity = fsp_next_capacity(ctx, ctx->data_length + length);
+      if(!new_capacity)
+        return -1; /* Over the configured ceiling */
+
+      if(fsp_buffer_set_capacity(ctx, new_capacity) < 0)
+        return -1; /* Out of memory */
+
+      ctx->stats.buffer_grows++;
+      if(ctx->buffer_capacity > ctx->stats.peak_buffer_capacity)
+        ctx->stats.peak_buffer_capacity = ctx->buffer_capacity;
+    }
+  }
+
+  /* Append data to buffer */
+  memcpy(ctx->stream_buffer + ctx->data_length, data, length);
+  ctx->data_length += length;
+
+  ctx->stats.bytes_appended += length;
+  fsp_stats_note_unread(ctx);
+  FSP_TRACE_EVENT(ctx, FSP_TRACE_APPEND, length);
+
+  return 0;
+}
+
+
+/**
+ * fsp_buffer_append - Append data to the context's stream buffer
+ *
+ * @ctx: The context to append data to
+ * @data: The data to append
+ * @length: The length of the data to append
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_buffer_append(fsp_context *ctx, const char *data, size_t length)
+{
+  if(!ctx || !data || length == 0)
+    return 0;
+
+  /* Preserve byte order when mixing with zero-copy mode: any
+   * unconsumed borrowed bytes must land in the buffer first */
+  if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    if(fsp_chunk_refs_spill(ctx) < 0)
+      return -1;
+  }
+
+  return fsp_buffer_append_raw(ctx, data, length);
+}
+
+
+/**
+ * fsp_buffer_append_iov - Append an array of fragments in a single pass
+ *
+ * @ctx: The context to append data to
+ * @iov: Array of fragments to append, in order
+ * @iovcnt: Number of fragments in @iov
+ *
+ * Vectored variant of fsp_buffer_append(): sizes the buffer once for
+ * the total length, then copies all fragments back to back, so the
+ * capacity check and potential compaction/growth run once per message
+ * instead of once per fragment.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_buffer_append_iov(fsp_context *ctx, const fsp_iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  int i;
+
+  if(!ctx || !iov || iovcnt <= 0)
+    return 0;
+
+  for(i = 0; i < iovcnt; i++)
+    total += iov[i].iov_len;
+
+  if(total == 0)
+    return 0;
+
+  /* Preserve byte order when mixing with zero-copy mode */
+  if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    if(fsp_chunk_refs_spill(ctx) < 0)
+      return -1;
+  }
+
+  if(ctx->ring_mode) {
+    /* One growth check for the whole message; the per-fragment appends
+     * below are then pure wrap-splitting memcpys */
+    if(fsp_ring_grow(ctx, total) < 0)
+      return -1;
+
+    for(i = 0; i < iovcnt; i++) {
+      if(iov[i].iov_len > 0 &&
+         fsp_buffer_append_raw(ctx, iov[i].iov_base, iov[i].iov_len) < 0)
+        return -1;
+    }
+    return 0;
+  }
+
+#ifdef FSP_HAVE_SPILL
+  /* Spill-aware fallback: once backlog has spilled - or this message
+   * would push the unread backlog past the spill threshold - the
+   * reserve/commit fast path below would either refuse outright or
+   * grow RAM past the configured cap.  Append the fragments one by
+   * one instead; fsp_buffer_append_raw() routes them through
+   * fsp_spill_write() exactly as the scalar append does. */
+  if(ctx->config.spill_threshold && ctx->keep_from == (size_t)-1 &&
+     (ctx->spill_read < ctx->spill_length ||
+      (ctx->data_length - ctx->read_position) + total >
+        ctx->config.spill_threshold)) {
+    for(i = 0; i < iovcnt; i++) {
+      if(iov[i].iov_len > 0 &&
+         fsp_buffer_append_raw(ctx, iov[i].iov_base, iov[i].iov_len) < 0)
+        return -1;
+    }
+    return 0;
+  }
+#endif
+
+  /* Linear mode: reserve contiguous space for the total once and copy
+   * the fragments back to back */
+  {
+    char *dest;
+    size_t avail;
+
+    if(fsp_buffer_reserve(ctx, total, &dest, &avail) < 0)
+      return -1;
+
+    for(i = 0; i < iovcnt; i++) {
+      if(iov[i].iov_len > 0) {
+        memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+        dest += iov[i].iov_len;
+      }
+    }
+
+    return fsp_buffer_commit(ctx, total);
+  }
+}
+
+
+/**
+ * fsp_buffer_reserve - Reserve writable space directly in the stream buffer
+ *
+ * @ctx: The context to reserve space in
+ * @min_size: Minimum contiguous bytes the caller needs
+ * @ptr: Returns a writable pointer into the stream buffer
+ * @available: Returns the contiguous bytes available at @ptr
+ *
+ * Direct-fill entry point so e.g. a socket read() can land straight in
+ * the parse buffer without an intermediate copy.  Compacts or grows
+ * the buffer as fsp_buffer_append() would to satisfy @min_size.  The
+ * returned pointer is valid until the next call that mutates the
+ * buffer; publish the bytes actually written with fsp_buffer_commit().
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_buffer_reserve(fsp_context *ctx, size_t min_size, char **ptr,
+                   size_t *available)
+{
+  size_t write_position;
+  size_t contiguous;
+
+  if(!ctx || !ptr || !available)
+    return -1;
+
+  /* The SPSC ring's write index is published atomically by
+   * fsp_buffer_append(); a two-step reserve/commit cannot be */
+  if(ctx->spsc_mode)
+    return -1;
+
+  /* Committed bytes would jump ahead of the spilled backlog */
+  if(ctx->spill_read < ctx->spill_length)
+    return -1;
+
+  /* Preserve byte order when mixing with zero-copy mode */
+  if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    if(fsp_chunk_refs_spill(ctx) < 0)
+      return -1;
+  }
+
+  if(ctx->ring_mode) {
+    if(fsp_ring_grow(ctx, min_size) < 0)
+      return -1;
+
+    write_position = (ctx->read_position + ctx->data_length)
+                     % ctx->buffer_capacity;
+    if(write_position < ctx->read_position ||
+       (write_position == ctx->read_position && ctx->data_length > 0))
+      contiguous = ctx->read_position - write_position;
+    else
+      contiguous = ctx->buffer_capacity - write_position;
+
+    if(contiguous < min_size) {
+      /* Not enough contiguous space at the ring end - linearize */
+      if(fsp_ring_linearize(ctx) < 0)
+        return -1;
+      write_position = ctx->data_length;
+      contiguous = ctx->buffer_capacity - write_position;
+    }
+
+    *ptr = ctx->stream_buffer + write_position;
+    *available = contiguous;
+    return 0;
+  }
+
+  /* Linear mode: compact then grow, as fsp_buffer_append() does */
+  if(ctx->data_length + min_size > ctx->buffer_capacity) {
+    fsp_buffer_compact(ctx);
+
+    if(ctx->data_length + min_size > ctx->buffer_capacity) {
+      size_t new_capacity;
+
+      new_capacity = fsp_next_capacity(ctx, ctx->data_length + min_size);
+      if(!new_capacity)
+        return -1; /* Over the configured ceiling */
+
+      if(fsp_buffer_set_capacity(ctx, new_capacity) < 0)
+        return -1; /* Out of memory */
+
+      ctx->stats.buffer_grows++;
+      if(ctx->buffer_capacity > ctx->stats.peak_buffer_capacity)
+        ctx->stats.peak_buffer_capacity = ctx->buffer_capacity;
+    }
+  }
+
+  *ptr = ctx->stream_buffer + ctx->data_length;
+  *available = ctx->buffer_capacity - ctx->data_length;
+  return 0;
+}
+
+
+/**
+ * fsp_buffer_commit - Publish bytes written into reserved buffer space
+ *
+ * @ctx: The context to commit bytes to
+ * @length: Bytes actually written at the pointer from fsp_buffer_reserve()
+ *
+ * Returns: 0 on success, -1 on failure (more than the reserved space)
+ */
+int
+fsp_buffer_commit(fsp_context *ctx, size_t length)
+{
+  if(!ctx || ctx->spsc_mode)
+    return -1;
+
+  if(ctx->data_length + length > ctx->buffer_capacity)
+    return -1;
+
+  if(ctx->newline_index_enabled) {
+    /* The committed bytes are contiguous: fsp_buffer_reserve()
+     * linearized the ring end if necessary */
+    const char *start;
+
+    if(ctx->ring_mode)
+      start = ctx->stream_buffer +
+              (ctx->read_position + ctx->data_length) % ctx->buffer_capacity;
+    else
+      start = ctx->stream_buffer + ctx->data_length;
+
+    if(fsp_newline_index_note(ctx, start, length) < 0)
+      return -1;
+  }
+
+  ctx->data_length += length;
+
+  ctx->stats.bytes_appended += length;
+  fsp_stats_note_unread(ctx);
+
+  return 0;
+}
+
+
+/**
+ * fsp_parse_committed - Drive parsing from already-committed buffer data
+ *
+ * @ctx: The context to parse in
+ * @is_end: Whether the committed data is the last of the stream
+ *
+ * Companion to fsp_buffer_reserve()/fsp_buffer_commit(): behaves like
+ * fsp_parse_chunk() without the append, for data the caller has
+ * already placed in the stream buffer.
+ *
+ * Returns: A status code
+ */
+fsp_status
+fsp_parse_committed(fsp_context *ctx, int is_end)
+{
+  if(!ctx)
+    return FSP_STATUS_ERROR;
+
+  /* Update EOF flag */
+  ctx->more_chunks_expected = !is_end;
+
+  if(!is_end)
+    return FSP_STATUS_NEED_DATA;
+
+  return FSP_STATUS_OK;
+}
+
+
+/**
+ * fsp_buffer_compact - Compact the context's stream buffer
+ *
+ * @ctx: The context to compact
+ */
+void
+fsp_buffer_compact(fsp_context *ctx)
+{
+  size_t unread;
+  size_t discard;
+
+  if(!ctx)
+    return;
+
+  /* Ring and SPSC modes reclaim consumed space on read; nothing to
+   * move (and in SPSC mode the consumer may be mid-read) */
+  if(ctx->ring_mode || ctx->spsc_mode)
+    return;
+
+  /* Discard up to the read position, or only up to the host's keep
+   * mark when an in-progress token still references earlier bytes */
+  discard = fsp_keep_position(ctx);
+
+  unread = ctx->data_length - discard;
+  if(unread > 0 && discard > 0) {
+    memmove(ctx->stream_buffer,
+            ctx->stream_buffer + discard,
+            unread);
+    ctx->stats.compactions++;
+    ctx->stats.compaction_bytes_moved += unread;
+    FSP_TRACE_EVENT(ctx, FSP_TRACE_COMPACT, unread);
+  }
+
+  ctx->data_length = unread;
+  ctx->read_position -= discard;
+  ctx->stream_consumed += discard;
+
+  /* Shrink-on-compact: give grown memory back once the backlog fits
+   * in the configured threshold again */
+  if(ctx->config.shrink_threshold &&
+     ctx->stream_buffer != ctx->inline_buffer &&
+     ctx->buffer_capacity > ctx->config.shrink_threshold &&
+     unread <= ctx->config.shrink_threshold) {
+    char *new_buffer = FSP_REALLOC(char*, ctx->stream_buffer,
+                                   ctx->config.shrink_threshold);
+
+    if(new_buffer) {
+      ctx->stream_buffer = new_buffer;
+      ctx->buffer_capacity = ctx->config.shrink_threshold;
+    }
+    /* A failed shrink just keeps the larger buffer */
+  }
+}
+
+
+/**
+ * fsp_set_keep_from - Mark the earliest byte an in-progress token still needs
+ *
+ * @ctx: The context to set the keep mark on
+ * @offset: Absolute stream offset (bytes since creation or reset) of
+ *   the first byte still referenced by the host lexer's unfinished
+ *   token, or (size_t)-1 to clear the mark
+ *
+ * fsp_buffer_compact() and the automatic compaction inside
+ * fsp_buffer_append() normally treat everything before the read
+ * position as dead, but flex has usually consumed bytes belonging to a
+ * token it has not finished matching.  With a keep mark set,
+ * compaction preserves bytes from the mark onwards, so hosts can
+ * compact aggressively after every chunk and hold steady-state buffers
+ * near the token size instead of the document size.  The host advances
+ * the mark as tokens complete.
+ *
+ * While a mark is set borrowed chunks (fsp_parse_chunk_borrowed()) are
+ * copied through the stream buffer - kept bytes must outlive the
+ * caller's chunk.  Not available in ring or SPSC modes, and the marked
+ * byte must not already have been discarded by an earlier compaction.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_set_keep_from(fsp_context *ctx, size_t offset)
+{
+  if(!ctx || ctx->ring_mode || ctx->spsc_mode)
+    return -1;
+
+  if(offset == (size_t)-1) {
+    ctx->keep_from = (size_t)-1;
+    return 0;
+  }
+
+  /* Bytes before the marked one may be gone, but the mark itself must
+   * still be reachable */
+  if(offset < ctx->stream_consumed)
+    return -1;
+
+  /* Backlog in the spill file cannot be pinned in RAM */
+  if(ctx->spill_read < ctx->spill_length)
+    return -1;
+
+  /* Existing borrowed bytes must move into the buffer now: the keep
+   * contract cannot be honoured for caller-owned chunks */
+  if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    if(fsp_chunk_refs_spill(ctx) < 0)
+      return -1;
+  }
+
+  ctx->keep_from = offset;
+
+  return 0;
+}
+
+
+/**
+ * fsp_buffer_available - Get the number of available bytes in the context's stream buffer
+ *
+ * @ctx: The context to get the available bytes from
+ *
+ * Returns: The number of available bytes
+ */
+size_t
+fsp_buffer_available(fsp_context *ctx)
+{
+  if(!ctx)
+    return 0;
+
+#ifdef FSP_HAVE_ATOMICS
+  if(ctx->spsc_mode) {
+    /* Callable from either thread; a momentarily stale answer is fine */
+    size_t write_position = FSP_ATOMIC_LOAD(&ctx->spsc_write_position);
+    size_t read_position = FSP_ATOMIC_LOAD(&ctx->spsc_read_position);
+
+    return (write_position + ctx->buffer_capacity - read_position) %
+           ctx->buffer_capacity;
+  }
+#endif
+
+  if(ctx->ring_mode)
+    return ctx->data_length + fsp_chunk_refs_available(ctx);
+
+  return (ctx->data_length - ctx->read_position) +
+         (ctx->spill_length - ctx->spill_read) +
+         fsp_chunk_refs_available(ctx);
+}
+
+
+/**
+ * fsp_set_ring_buffer - Switch the stream buffer between linear and circular storage
+ *
+ * @ctx: The context to switch
+ * @enable: Non-zero to enable ring (circular) mode, zero for linear mode
+ *
+ * In ring mode consumed space is reclaimed by a pointer update instead
+ * of the memmove compaction the linear mode performs, which avoids
+ * sliding unread bytes on every append for long-lived streams.  Any
+ * buffered data is preserved across the switch.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_set_ring_buffer(fsp_context *ctx, int enable)
+{
+  if(!ctx || ctx->spsc_mode)
+    return -1;
+
+  /* The ring reclaims consumed bytes on read, which is incompatible
+   * with a keep mark holding bytes behind the read position; spilled
+   * backlog likewise has no place in the ring */
+  if(enable && (ctx->keep_from != (size_t)-1 ||
+                ctx->spill_read < ctx->spill_length))
+    return -1;
+
+  if((enable != 0) == ctx->ring_mode)
+    return 0;
+
+  if(enable) {
+    /* After compaction the linear and ring representations coincide:
+     * unread bytes start at offset 0 and data_length counts them */
+    fsp_buffer_compact(ctx);
+    ctx->ring_mode = 1;
+    return 0;
+  }
+
+  /* Linearize the ring back into a flat buffer starting at offset 0 */
+  if(fsp_ring_linearize(ctx) < 0)
+    return -1;
+
+  ctx->ring_mode = 0;
+
+  return 0;
+}
+
+
+/**
+ * fsp_set_spsc - Switch the stream buffer to a lock-free single-producer/single-consumer ring
+ *
+ * @ctx: The context to switch
+ * @enable: Non-zero to enable SPSC mode, zero to return to linear mode
+ *
+ * In SPSC mode one thread may call fsp_buffer_append() (or
+ * fsp_parse_chunk()) while another concurrently drives
+ * fsp_read_input()/the push parser, with no mutex on either path: each
+ * thread owns its ring index and publishes it atomically.  The buffer
+ * capacity is fixed while the mode is enabled - size it up front with
+ * fsp_create_with_config() - and an append that does not fit fails
+ * with -1 so the producer can retry after the consumer drains.  The
+ * zero-copy, reserve/commit and ring-compaction entry points are
+ * unavailable in this mode.  Both threads must have quiesced before
+ * calling this function (in either direction); any buffered data is
+ * preserved across the switch.
+ *
+ * Returns: 0 on success, -1 on failure (including platforms without
+ * atomic builtins)
+ */
+int
+fsp_set_spsc(fsp_context *ctx, int enable)
+{
+#ifdef FSP_HAVE_ATOMICS
+  if(!ctx)
+    return -1;
+
+  if((enable != 0) == ctx->spsc_mode)
+    return 0;
+
+  if(enable) {
+    /* Like the plain ring, the SPSC ring reclaims consumed bytes on
+     * read and cannot honour a keep mark */
+    if(ctx->keep_from != (size_t)-1)
+      return -1;
+
+    /* Input filters decompress through reserve/commit, which the SPSC
+     * ring does not support; same for pending spilled backlog */
+    if(ctx->input_filter != FSP_FILTER_NONE ||
+       ctx->spill_read < ctx->spill_length)
+      return -1;
+
+    /* Fold any pending borrowed bytes into the buffer and linearize so
+     * the unread backlog sits at offset 0 */
+    if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+      if(fsp_chunk_refs_spill(ctx) < 0)
+        return -1;
+    }
+    if(ctx->ring_mode) {
+      if(fsp_ring_linearize(ctx) < 0)
+        return -1;
+      ctx->ring_mode = 0;
+    } else
+      fsp_buffer_compact(ctx);
+
+    /* The ring capacity is fixed while the mode is enabled, so promote
+     * out of the inline buffer up to the configured size first */
+    if(ctx->stream_buffer == ctx->inline_buffer &&
+       ctx->buffer_capacity < ctx->config.initial_buffer_size) {
+      if(fsp_buffer_set_capacity(ctx, ctx->config.initial_buffer_size) < 0)
+        return -1;
+    }
+
+    /* One slot must stay empty to distinguish full from empty */
+    if(ctx->data_length >= ctx->buffer_capacity)
+      return -1;
+
+    ctx->spsc_read_position = 0;
+    ctx->spsc_write_position = ctx->data_length;
+    ctx->data_length = 0;
+    ctx->read_position = 0;
+    ctx->spsc_mode = 1;
+
+    return 0;
+  }
+
+  /* Disable: map the SPSC indices onto the ring fields and reuse the
+   * ring linearization to put the unread bytes back at offset 0 */
+  ctx->read_position = ctx->spsc_read_position;
+  ctx->data_length = (ctx->spsc_write_position + ctx->buffer_capacity -
+                      ctx->spsc_read_position) % ctx->buffer_capacity;
+  if(fsp_ring_linearize(ctx) < 0) {
+    ctx->read_position = 0;
+    ctx->data_length = 0;
+    return -1;
+  }
+
+  ctx->spsc_read_position = 0;
+  ctx->spsc_write_position = 0;
+  ctx->spsc_mode = 0;
+
+  return 0;
+#else
+  (void)ctx;
+  (void)enable;
+  return -1;
+#endif
+}
+
+
+/**
+ * fsp_set_watermarks - Configure backpressure on the unread backlog
+ *
+ * @ctx: The context to configure
+ * @high_watermark: Unread byte count at which new chunks are refused;
+ *   0 disables backpressure
+ * @low_watermark: Unread byte count at which @callback is invoked
+ * @callback: Drain notification, or NULL for none
+ * @user_data: Opaque pointer passed to @callback
+ *
+ * With a high watermark set, the parse entry points return
+ * FSP_STATUS_WOULD_BLOCK instead of appending once the unread backlog
+ * (buffered plus borrowed bytes) reaches @high_watermark; the host
+ * should stop reading its socket and retry the refused chunk later.
+ * After a refusal, when fsp_read_input() drains the backlog to
+ * @low_watermark the @callback fires once, telling the host to resume
+ * reading.  fsp_reset() drops the backlog without firing the callback.
+ */
+void
+fsp_set_watermarks(fsp_context *ctx, size_t high_watermark,
+                   size_t low_watermark, fsp_drain_callback callback,
+                   void *user_data)
+{
+  if(!ctx)
+    return;
+
+  ctx->high_watermark = high_watermark;
+  ctx->low_watermark = low_watermark;
+  ctx->drain_callback = callback;
+  ctx->drain_callback_user_data = user_data;
+  ctx->backpressured = 0;
+}
+
+
+/**
+ * fsp_set_input_filter - Select a transparent decompression stage
+ *
+ * @ctx: The context to set the filter on
+ * @filter: FSP_FILTER_NONE, FSP_FILTER_GZIP or FSP_FILTER_ZSTD
+ *
+ * With a filter set, the parse entry points are fed the compressed
+ * stream and the filter decompresses directly into the stream buffer
+ * space an append would have targeted, dropping the intermediate
+ * full-size buffer and copy hosts otherwise hand-roll.  The streaming
+ * semantics are unchanged: chunks may split the compressed stream
+ * anywhere and is_end marks its last bytes - a stream still truncated
+ * at that point fails with FSP_STATUS_ERROR, as do corrupt bytes.
+ * Concatenated gzip members and zstd frames are decompressed back to
+ * back.  The SPSC mode does not combine with a filter; zero-copy
+ * chunks are decompressed (copied) like any others.  gzip needs zlib
+ * and zstd needs libzstd at build time.  Selecting FSP_FILTER_NONE
+ * (or destroying the context) releases the decompressor state.
+ *
+ * Returns: 0 on success, -1 on failure (unknown or unbuilt filter)
+ */
+int
+fsp_set_input_filter(fsp_context *ctx, fsp_input_filter filter)
+{
+  if(!ctx || ctx->spsc_mode)
+    return -1;
+
+  if((int)filter == ctx->input_filter)
+    return 0;
+
+  /* Changing filters drops any previous decompressor state */
+  fsp_filter_teardown(ctx);
+
+  switch(filter) {
+    case FSP_FILTER_NONE:
+      return 0;
+
+    case FSP_FILTER_GZIP: {
+#ifdef HAVE_ZLIB_H
+      z_stream *strm = FSP_CALLOC(z_stream*, 1, sizeof(*strm));
+
+      if(!strm)
+        return -1;
+
+      /* 15 + 32: maximum window, accept gzip or zlib headers */
+      if(inflateInit2(strm, 15 + 32) != Z_OK) {
+        FSP_FREE(z_stream*, strm);
+        return -1;
+      }
+
+      ctx->filter_state = strm;
+      ctx->input_filter = FSP_FILTER_GZIP;
+      return 0;
+#else
+      return -1;
+#endif
+    }
+
+    case FSP_FILTER_ZSTD: {
+#ifdef HAVE_ZSTD_H
+      ZSTD_DStream *dstream = ZSTD_createDStream();
+
+      if(!dstream)
+        return -1;
+
+      if(ZSTD_isError(ZSTD_initDStream(dstream))) {
+        ZSTD_freeDStream(dstream);
+        return -1;
+      }
+
+      ctx->filter_state = dstream;
+      ctx->input_filter = FSP_FILTER_ZSTD;
+      return 0;
+#else
+      return -1;
+#endif
+    }
+  }
+
+  return -1;
+}
+
+
+/**
+ * fsp_set_user_data - Set the user data pointer for the context
+ *
+ * @ctx: The context to set the user data pointer for
+ * @user_data: The user data pointer to set
+ */
+void
+fsp_set_user_data(fsp_context *ctx, void *user_data)
+{
+  if(ctx)
+    ctx->user_data = user_data;
+}
+
+
+/**
+ * fsp_get_user_data - Get the user data pointer for the context
+ *
+ * @ctx: The context to get the user data pointer from
+ *
+ * Returns: The user data pointer
+ */
+void*
+fsp_get_user_data(fsp_context *ctx)
+{
+  return ctx ? ctx->user_data : NULL;
+}
+
+
+/* Backpressure test shared by the parse entry points: refuse a
+ * non-empty chunk when the unread backlog has reached the high
+ * watermark, and remember the refusal so fsp_read_input() can fire the
+ * drain callback once the backlog reaches the low watermark */
+static int
+fsp_would_block(fsp_context *ctx, size_t incoming)
+{
+  if(!ctx->high_watermark || !incoming)
+    return 0;
+
+  if(fsp_buffer_available(ctx) < ctx->high_watermark)
+    return 0;
+
+  ctx->backpressured = 1;
+  return 1;
+}
+
+
+/**
+ * fsp_parse_chunk - Parse a chunk of input data
+ *
+ * @ctx: The context to parse the chunk in
+ * @chunk: The chunk of input data to parse
+ * @length: The length of the chunk of input data to parse
+ * @is_end: Whether this is the last chunk of input data
+ *
+ * Returns: A status code
+ */
+fsp_status
+fsp_parse_chunk(fsp_context *ctx, const char *chunk, size_t length, int is_end)
+{
+  if(!ctx)
+    return FSP_STATUS_ERROR;
+
+  if(fsp_would_block(ctx, length))
+    return FSP_STATUS_WOULD_BLOCK;
+
+  /* Append chunk to buffer, decompressing when a filter is set */
+  if(ctx->input_filter != FSP_FILTER_NONE) {
+    if(fsp_filter_append(ctx, chunk, length) != 0)
+      return FSP_STATUS_ERROR;
+  } else if(fsp_buffer_append(ctx, chunk, length) != 0)
+    return FSP_STATUS_NO_MEMORY;
+
+  /* Update EOF flag */
+  ctx->more_chunks_expected = !is_end;
+
+  FSP_TRACE_EVENT(ctx, FSP_TRACE_PARSE_CHUNK, length);
+
+  /* The compressed stream must be complete once the input ends */
+  if(is_end && ctx->input_filter != FSP_FILTER_NONE &&
+     ctx->filter_saw_input && !ctx->filter_at_end)
+    return FSP_STATUS_ERROR;
+
+  /* Note: Actual parsing happens in host-specific code
+   * This is just the buffer management layer */
+  if(is_end && ctx->data_length > 0)
+    return FSP_STATUS_OK;
+  else if(!is_end)
+    return FSP_STATUS_NEED_DATA;
+  else
+    return FSP_STATUS_OK;
+}
+
+
+/**
+ * fsp_parse_chunk_iov - Parse a message delivered as an array of fragments
+ *
+ * @ctx: The context to parse the fragments in
+ * @iov: Array of fragments, in order
+ * @iovcnt: Number of fragments in @iov
+ * @is_end: Whether this is the last input of the stream
+ *
+ * Vectored variant of fsp_parse_chunk() for framing layers that hand
+ * over messages as iovec arrays; see fsp_buffer_append_iov().
+ *
+ * Returns: A status code
+ */
+fsp_status
+fsp_parse_chunk_iov(fsp_context *ctx, const fsp_iovec *iov, int iovcnt,
+                    int is_end)
+{
+  if(!ctx)
+    return FSP_STATUS_ERROR;
+
+  if(fsp_would_block(ctx, (size_t)(iovcnt > 0)))
+    return FSP_STATUS_WOULD_BLOCK;
+
+  if(ctx->input_filter != FSP_FILTER_NONE) {
+    int i;
+
+    for(i = 0; i < iovcnt; i++) {
+      if(fsp_filter_append(ctx, iov[i].iov_base, iov[i].iov_len) != 0)
+        return FSP_STATUS_ERROR;
+    }
+  } else if(fsp_buffer_append_iov(ctx, iov, iovcnt) != 0)
+    return FSP_STATUS_NO_MEMORY;
+
+  /* Update EOF flag */
+  ctx->more_chunks_expected = !is_end;
+
+  if(is_end && ctx->input_filter != FSP_FILTER_NONE &&
+     ctx->filter_saw_input && !ctx->filter_at_end)
+    return FSP_STATUS_ERROR; /* Truncated compressed stream */
+
+  if(!is_end)
+    return FSP_STATUS_NEED_DATA;
+
+  return FSP_STATUS_OK;
+}
+
+
+/**
+ * fsp_parse_chunk_borrowed - Parse a chunk of input data without copying it
+ *
+ * @ctx: The context to parse the chunk in
+ * @chunk: The chunk of input data to parse
+ * @length: The length of the chunk of input data to parse
+ * @is_end: Whether this is the last chunk of input data
+ *
+ * Zero-copy variant of fsp_parse_chunk(): the chunk is recorded by
+ * reference and fsp_read_input() serves reads directly from it, so the
+ * bytes are copied once (into the lexer) instead of twice.  The caller
+ * must keep the chunk valid and unmodified until its bytes have been
+ * consumed - in practice until the host's next lex/parse cycle returns
+ * needing more data, or the context is destroyed.
+ *
+ * Returns: A status code
+ */
+fsp_status
+fsp_parse_chunk_borrowed(fsp_context *ctx, const char *chunk, size_t length,
+                         int is_end)
+{
+  if(!ctx)
+    return FSP_STATUS_ERROR;
+
+  if(fsp_would_block(ctx, length))
+    return FSP_STATUS_WOULD_BLOCK;
+
+  /* Compressed bytes cannot be served by reference - decompression
+   * writes fresh bytes into the buffer anyway, so borrow nothing */
+  if(ctx->input_filter != FSP_FILTER_NONE)
+    return fsp_parse_chunk(ctx, chunk, length, is_end);
+
+  if(chunk && length > 0) {
+    if(fsp_chunk_refs_push(ctx, chunk, length) < 0)
+      return FSP_STATUS_NO_MEMORY;
+  }
+
+  /* Update EOF flag */
+  ctx->more_chunks_expected = !is_end;
+
+  if(!is_end)
+    return FSP_STATUS_NEED_DATA;
+
+  return FSP_STATUS_OK;
+}
+
+
+/**
+ * fsp_attach_mapping - Attach a caller-owned memory region as the whole input
+ *
+ * @ctx: The context to attach the region to
+ * @ptr: Start of the region
+ * @length: Length of the region in bytes
+ *
+ * Points the context's read path directly at @ptr without using the
+ * stream buffer - the region is served zero-copy like a borrowed
+ * chunk and marks the end of the stream.  The caller must keep the
+ * region valid until parsing finishes.  Useful for already-mapped
+ * files or whole messages held in caller memory.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_attach_mapping(fsp_context *ctx, const char *ptr, size_t length)
+{
+  if(!ctx || (!ptr && length > 0))
+    return -1;
+
+  /* A filtered mapping is decompressed into the buffer up front; it is
+   * the whole input, so the compressed stream must also be complete */
+  if(ctx->input_filter != FSP_FILTER_NONE) {
+    if(length > 0 && fsp_filter_append(ctx, ptr, length) != 0)
+      return -1;
+    if(ctx->filter_saw_input && !ctx->filter_at_end)
+      return -1;
+    ctx->more_chunks_expected = 0;
+    return 0;
+  }
+
+  if(length > 0) {
+    if(fsp_chunk_refs_push(ctx, ptr, length) < 0)
+      return -1;
+  }
+
+  /* The mapping is the whole input */
+  ctx->more_chunks_expected = 0;
+
+  return 0;
+}
+
+
+/**
+ * fsp_parse_file - Parse a whole file, memory-mapping it when possible
+ *
+ * @ctx: The context to parse the file in
+ * @filename: Path of the file to parse
+ *
+ * Maps the file read-only, advises the kernel of sequential access
+ * and serves reads zero-copy from the mapping, so batch reprocessing
+ * avoids the chunk copies of fsp_parse_chunk().  The mapping is
+ * released by fsp_destroy(), fsp_reset() or a later fsp_parse_file().
+ * On platforms without mmap the file is read into the stream buffer
+ * instead.
+ *
+ * Returns: A status code
+ */
+fsp_status
+fsp_parse_file(fsp_context *ctx, const char *filename)
+{
+  if(!ctx || !filename)
+    return FSP_STATUS_ERROR;
+
+  /* Only one mapping at a time */
+  fsp_release_mapping(ctx);
+
+#ifdef HAVE_SYS_MMAN_H
+  {
+    int fd;
+    struct stat st;
+    void *mapping;
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0)
+      return FSP_STATUS_ERROR;
+
+    if(fstat(fd, &st) < 0) {
+      close(fd);
+      return FSP_STATUS_ERROR;
+    }
+
+    if(st.st_size == 0) {
+      /* Empty file - nothing to map, just mark EOF */
+      close(fd);
+      ctx->more_chunks_expected = 0;
+      return FSP_STATUS_OK;
+    }
+
+    mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+      return FSP_STATUS_ERROR;
+
+#ifdef MADV_SEQUENTIAL
+    (void)madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    if(fsp_attach_mapping(ctx, (const char*)mapping, (size_t)st.st_size) < 0) {
+      munmap(mapping, (size_t)st.st_size);
+      return FSP_STATUS_NO_MEMORY;
+    }
+
+    ctx->file_mapping = mapping;
+    ctx->file_mapping_length = (size_t)st.st_size;
+
+    return FSP_STATUS_OK;
+  }
+#else
+  {
+    FILE *fp;
+    char chunk[16 * 1024];
+    size_t bytes_read;
+
+    fp = fopen(filename, "rb");
+    if(!fp)
+      return FSP_STATUS_ERROR;
+
+    while((bytes_read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+      if(ctx->input_filter != FSP_FILTER_NONE) {
+        if(fsp_filter_append(ctx, chunk, bytes_read) < 0) {
+          fclose(fp);
+          return FSP_STATUS_ERROR;
+        }
+      } else if(fsp_buffer_append(ctx, chunk, bytes_read) < 0) {
+        fclose(fp);
+        return FSP_STATUS_NO_MEMORY;
+      }
+    }
+
+    if(ferror(fp)) {
+      fclose(fp);
+      return FSP_STATUS_ERROR;
+    }
+
+    fclose(fp);
+    ctx->more_chunks_expected = 0;
+
+    return FSP_STATUS_OK;
+  }
+#endif
+}
+
+
+
+/* Scalar reference scanner; also finishes the sub-vector tail for the
+ * SIMD implementations */
+static size_t
+fsp_scan_scalar(const char *data, size_t length, int delim1, int delim2)
+{
+  size_t i;
+
+  for(i = 0; i < length; i++) {
+    if(data[i] == (char)delim1 || data[i] == (char)delim2)
+      return i;
+  }
+
+  return length;
+}
+
+
+#ifdef FSP_SCAN_X86
+
+/* SSE2 is part of the x86-64 baseline so this needs no runtime check */
+static size_t
+fsp_scan_sse2(const char *data, size_t length, int delim1, int delim2)
+{
+  const __m128i v1 = _mm_set1_epi8((char)delim1);
+  const __m128i v2 = _mm_set1_epi8((char)delim2);
+  size_t i = 0;
+
+  while(i + 16 <= length) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, v1),
+                                _mm_cmpeq_epi8(bytes, v2));
+    int mask = _mm_movemask_epi8(hits);
+
+    if(mask)
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+    i += 16;
+  }
+
+  return i + fsp_scan_scalar(data + i, length - i, delim1, delim2);
+}
+
+__attribute__((target("avx2")))
+static size_t
+fsp_scan_avx2(const char *data, size_t length, int delim1, int delim2)
+{
+  const __m256i v1 = _mm256_set1_epi8((char)delim1);
+  const __m256i v2 = _mm256_set1_epi8((char)delim2);
+  size_t i = 0;
+
+  while(i + 32 <= length) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, v1),
+                                   _mm256_cmpeq_epi8(bytes, v2));
+    int mask = _mm256_movemask_epi8(hits);
+
+    if(mask)
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+    i += 32;
+  }
+
+  return i + fsp_scan_sse2(data + i, length - i, delim1, delim2);
+}
+
+#endif /* FSP_SCAN_X86 */
+
+
+#ifdef FSP_SCAN_NEON
+
+static size_t
+fsp_scan_neon(const char *data, size_t length, int delim1, int delim2)
+{
+  const uint8x16_t v1 = vdupq_n_u8((uint8_t)delim1);
+  const uint8x16_t v2 = vdupq_n_u8((uint8_t)delim2);
+  size_t i = 0;
+
+  while(i + 16 <= length) {
+    uint8x16_t bytes = vld1q_u8((const uint8_t*)(data + i));
+    uint8x16_t hits = vorrq_u8(vceqq_u8(bytes, v1), vceqq_u8(bytes, v2));
+
+    /* Any hit in this block?  The scalar loop pinpoints it */
+    if(vmaxvq_u8(hits))
+      return i + fsp_scan_scalar(data + i, 16, delim1, delim2);
+    i += 16;
+  }
+
+  return i + fsp_scan_scalar(data + i, length - i, delim1, delim2);
+}
+
+#endif /* FSP_SCAN_NEON */
+
+
+/* Pick the scanner once at first use.  The write is idempotent, so a
+ * race between threads resolving it concurrently is harmless. */
+static fsp_scan_fn fsp_scan_impl = NULL;
+
+static fsp_scan_fn
+fsp_scan_resolve(void)
+{
+#if defined(FSP_SCAN_X86)
+  if(__builtin_cpu_supports("avx2"))
+    return fsp_scan_avx2;
+  return fsp_scan_sse2;
+#elif defined(FSP_SCAN_NEON)
+  return fsp_scan_neon;
+#else
+  return fsp_scan_scalar;
+#endif
+}
+
+
+/**
+ * fsp_scan_delims - Find the first of up to two delimiter bytes in a range
+ *
+ * @data: The bytes to scan
+ * @length: The length of the range in bytes
+ * @delim1: First delimiter byte
+ * @delim2: Second delimiter byte, or negative for none
+ *
+ * SIMD fast path for bulk content inside long tokens: scans 16-32
+ * bytes per step (SSE2/AVX2/NEON, picked for the running CPU) instead
+ * of the byte-at-a-time walk a lexer DFA performs, so a host that
+ * knows it is inside an opaque payload can consume everything up to
+ * the next interesting byte in one action.
+ *
+ * Returns: Offset of the first matching byte, or @length if none
+ */
+size_t
+fsp_scan_delims(const char *data, size_t length, int delim1, int delim2)
+{
+  if(!data || length == 0)
+    return 0;
+
+  if(delim2 < 0)
+    delim2 = delim1;
+
+  if(!fsp_scan_impl)
+    fsp_scan_impl = fsp_scan_resolve();
+
+  return fsp_scan_impl(data, length, delim1, delim2);
+}
+
+
+/**
+ * fsp_scan_input - Find the first delimiter in the context's unread bytes
+ *
+ * @ctx: The context whose unread input to scan
+ * @delim1: First delimiter byte
+ * @delim2: Second delimiter byte, or negative for none
+ *
+ * Applies fsp_scan_delims() to the unread backlog without consuming
+ * anything, spanning the ring wrap and any borrowed chunk references.
+ * The caller can then pull exactly that many bytes of opaque content
+ * through fsp_read_input() in bulk.
+ *
+ * Returns: Number of unread bytes before the first matching byte, or
+ * the whole unread count if none match
+ */
+size_t
+fsp_scan_input(fsp_context *ctx, int delim1, int delim2)
+{
+  size_t total = 0;
+  size_t found;
+  size_t unread;
+  size_t first;
+  size_t i;
+
+  if(!ctx)
+    return 0;
+
+#ifdef FSP_HAVE_ATOMICS
+  if(ctx->spsc_mode) {
+    /* Consumer-side scan of the SPSC ring */
+    size_t read_position = ctx->spsc_read_position;
+    size_t write_position = FSP_ATOMIC_LOAD(&ctx->spsc_write_position);
+
+    unread = (write_position + ctx->buffer_capacity - read_position) %
+             ctx->buffer_capacity;
+    first = ctx->buffer_capacity - read_position;
+    if(first > unread)
+      first = unread;
+
+    found = fsp_scan_delims(ctx->stream_buffer + read_position, first,
+                            delim1, delim2);
+    if(found < first)
+      return found;
+    if(unread > first) {
+      found = fsp_scan_delims(ctx->stream_buffer, unread - first,
+                              delim1, delim2);
+      return first + found;
+    }
+    return unread;
+  }
+#endif
+
+  if(ctx->ring_mode) {
+    unread = ctx->data_length;
+    first = ctx->buffer_capacity - ctx->read_position;
+    if(first > unread)
+      first = unread;
+
+    found = fsp_scan_delims(ctx->stream_buffer + ctx->read_position, first,
+                            delim1, delim2);
+    if(found < first)
+      return found;
+    total = first;
+    if(unread > first) {
+      found = fsp_scan_delims(ctx->stream_buffer, unread - first,
+                              delim1, delim2);
+      total += found;
+      if(found < unread - first)
+        return total;
+    }
+  } else {
+    unread = ctx->data_length - ctx->read_position;
+    found = fsp_scan_delims(ctx->stream_buffer + ctx->read_position, unread,
+                            delim1, delim2);
+    total = found;
+    if(found < unread)
+      return total;
+
+    /* Backlog sitting in the spill file is not scannable in place;
+     * stop at the in-RAM bytes (references follow the spilled bytes) */
+    if(ctx->spill_read < ctx->spill_length)
+      return total;
+  }
+
+  /* Continue into the borrowed chunk references, in stream order */
+  for(i = ctx->chunk_refs_head; i < ctx->chunk_refs_count; i++) {
+    fsp_chunk_ref *ref = &ctx->chunk_refs[i];
+    size_t remaining = ref->length - ref->consumed;
+
+    found = fsp_scan_delims(ref->data + ref->consumed, remaining,
+                            delim1, delim2);
+    total += found;
+    if(found < remaining)
+      return total;
+  }
+
+  return total;
+}
+
+
+/**
+ * fsp_enable_newline_index - Maintain a newline-offset index for position reporting
+ *
+ * @ctx: The context to enable the index on
+ * @enable: Non-zero to enable, zero to disable
+ *
+ * With the index enabled, bytes are scanned for '\n' once, with the
+ * vectorized fsp_scan_delims(), as they enter the stream - instead of
+ * lexer actions re-touching every byte of large tokens to count lines.
+ * fsp_position_for_offset() then answers line/column queries by binary
+ * search.  Enable before feeding any data: offsets count from the
+ * enable point.  Disabling keeps the allocation but stops indexing.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_enable_newline_index(fsp_context *ctx, int enable)
+{
+  if(!ctx)
+    return -1;
+
+  if(enable) {
+    ctx->newline_count = 0;
+    ctx->newline_stream_length = 0;
+  }
+  ctx->newline_index_enabled = (enable != 0);
+
+  return 0;
+}
+
+
+/**
+ * fsp_position_for_offset - Map a stream offset to a line and column
+ *
+ * @ctx: The context holding the newline index
+ * @offset: Stream byte offset (counted from the index enable point)
+ * @line: Returns the 1-based line number, or NULL
+ * @column: Returns the 1-based column number, or NULL
+ *
+ * Binary-searches the index built by fsp_enable_newline_index(), so a
+ * lexer can report token positions with arithmetic instead of per-byte
+ * counting.
+ *
+ * Returns: 0 on success, -1 on failure (index disabled or @offset
+ * beyond the indexed stream)
+ */
+int
+fsp_position_for_offset(fsp_context *ctx, size_t offset, size_t *line,
+                        size_t *column)
+{
+  size_t lo = 0;
+  size_t hi;
+
+  if(!ctx || !ctx->newline_index_enabled ||
+     offset > ctx->newline_stream_length)
+    return -1;
+
+  /* Count newlines strictly before the offset */
+  hi = ctx->newline_count;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if(ctx->newline_offsets[mid] < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if(line)
+    *line = lo + 1;
+  if(column)
+    *column = offset - (lo ? ctx->newline_offsets[lo - 1] + 1 : 0) + 1;
+
+  return 0;
+}
+
+
+/**
+ * fsp_scan_window - Expose the unread bytes for in-place lexing
+ *
+ * @ctx: The context to arm
+ * @start: Returns a writable pointer to the first unread byte
+ * @length: Returns the number of unread bytes at @start
+ *
+ * In-place alternative to the YY_INPUT/fsp_read_input() copy path: the
+ * unread bytes are made contiguous and followed by the two NUL
+ * sentinel bytes flex requires, so the host can hand
+ * (@start, @length + 2) straight to yy_scan_buffer() and let the
+ * scanner walk the stream buffer itself - no shadow buffer, one less
+ * copy per byte.  After lexing stalls at the window end, report the
+ * bytes consumed by complete tokens with fsp_scan_window_consume(),
+ * append the next chunk and re-arm; the partial-token tail stays in
+ * the buffer across the cycle.  Not available in ring or SPSC mode.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_scan_window(fsp_context *ctx, char **start, size_t *length)
+{
+  char *sentinel;
+  size_t available;
+
+  if(!ctx || !start || !length)
+    return -1;
+
+  /* The window must be contiguous and stable while flex walks it */
+  if(ctx->ring_mode || ctx->spsc_mode)
+    return -1;
+
+  /* Reserve (but do not commit) the two sentinel bytes after the data;
+   * this also spills borrowed chunks, compacts and grows as needed */
+  if(fsp_buffer_reserve(ctx, 2, &sentinel, &available) < 0)
+    return -1;
+
+  sentinel[0] = '\0';
+  sentinel[1] = '\0';
+
+  *start = ctx->stream_buffer + ctx->read_position;
+  *length = ctx->data_length - ctx->read_position;
+
+  return 0;
+}
 
-#ifndef FSP_DEFAULT_BUFFER_SIZE
-#define FSP_DEFAULT_BUFFER_SIZE (64 * 1024)  /* 64KB */
-#endif
 
 /**
- * fsp_create - Create a new streaming parser context
+ * fsp_scan_window_consume - Report bytes consumed from an in-place scan window
  *
- * Returns:
- *   A new fsp_context, or NULL if memory allocation fails
+ * @ctx: The context the window came from
+ * @nbytes: Bytes from the window start covered by complete tokens
+ *
+ * Advances the read position past @nbytes so later compaction can
+ * reclaim them; anything beyond - the tail of a token still in
+ * progress - is preserved and reappears at the start of the next
+ * fsp_scan_window().
+ *
+ * Returns: 0 on success, -1 on failure (more than the window held)
  */
-fsp_context*
-fsp_create(void)
+int
+fsp_scan_window_consume(fsp_context *ctx, size_t nbytes)
 {
-  fsp_context *ctx;
+  if(!ctx || ctx->ring_mode || ctx->spsc_mode)
+    return -1;
 
-  ctx = (fsp_context*)calloc(1, sizeof(fsp_context));
-  if(!ctx)
-    return NULL;
+  if(nbytes > ctx->data_length - ctx->read_position)
+    return -1;
 
-  ctx->buffer_capacity = FSP_DEFAULT_BUFFER_SIZE;
-  ctx->stream_buffer = (char*)malloc(ctx->buffer_capacity);
-  if(!ctx->stream_buffer) {
-    free(ctx);
-    return NULL;
-  }
+  ctx->read_position += nbytes;
+  ctx->stats.bytes_read += nbytes;
 
-  ctx->data_length = 0;
-  ctx->read_position = 0;
-  ctx->more_chunks_expected = 1;
-  ctx->initialization_done = 0;
+  return 0;
+}
 
-  return ctx;
+
+/* Checkpoint wire format: fixed header then the raw backlog bytes.
+ * All size fields are 64-bit little-endian so checkpoints written on
+ * one host restore on another. */
+#define FSP_CHECKPOINT_MAGIC "FSPC"
+#define FSP_CHECKPOINT_VERSION 1
+#define FSP_CHECKPOINT_HEADER_SIZE 88
+
+/* Header flag bits */
+#define FSP_CHECKPOINT_FLAG_RING 1
+#define FSP_CHECKPOINT_FLAG_MORE 2
+#define FSP_CHECKPOINT_FLAG_KEEP 4
+
+
+static void
+fsp_checkpoint_put_u64(unsigned char *out, size_t value)
+{
+  int i;
+
+  for(i = 0; i < 8; i++)
+    out[i] = (unsigned char)((unsigned long long)value >> (i * 8));
+}
+
+
+static size_t
+fsp_checkpoint_get_u64(const unsigned char *in)
+{
+  unsigned long long value = 0;
+  int i;
+
+  for(i = 0; i < 8; i++)
+    value |= (unsigned long long)in[i] << (i * 8);
+
+  return (size_t)value;
 }
 
 
 /**
- * fsp_destroy - Destroy a streaming parser context
+ * fsp_checkpoint - Serialize the streaming state for failover or migration
  *
- * @ctx: The context to destroy
+ * @ctx: The context to checkpoint
+ * @writer: Sink hook invoked with the checkpoint bytes, in order
+ * @user_data: Opaque pointer passed to @writer
+ *
+ * Writes a compact versioned snapshot of the context's streaming
+ * state - the unread backlog (buffered, borrowed and spilled bytes),
+ * read position, keep mark, buffer configuration and end-of-input
+ * flag - so a stream processor rescheduled to another node can resume
+ * with fsp_restore() instead of re-parsing from byte zero.  The host
+ * should serialize its own parser/lexer snapshot to the same sink
+ * after this returns, and restore it after fsp_restore().
+ *
+ * Not carried: the newline index (re-enable it after restoring) and
+ * hot-path statistics.  A context in SPSC mode or with an input
+ * filter active cannot be checkpointed - the decompressor holds
+ * unserializable mid-stream state.
+ *
+ * Returns: 0 on success, -1 on failure (@writer failed or the context
+ * cannot be checkpointed)
  */
-void
-fsp_destroy(fsp_context *ctx)
+int
+fsp_checkpoint(fsp_context *ctx, fsp_checkpoint_writer writer, void *user_data)
 {
-  if(!ctx)
-    return;
+  unsigned char header[FSP_CHECKPOINT_HEADER_SIZE];
+  unsigned char flags = 0;
+  size_t base;
+  size_t backlog;
 
-  if(ctx->stream_buffer) {
-    free(ctx->stream_buffer);
-    ctx->stream_buffer = NULL;
+  if(!ctx || !writer)
+    return -1;
+
+  if(ctx->spsc_mode || ctx->input_filter != FSP_FILTER_NONE)
+    return -1;
+
+  /* Fold borrowed references into the buffer and linearize a ring so
+   * the in-RAM backlog is one contiguous span */
+  if(ctx->chunk_refs_head < ctx->chunk_refs_count) {
+    if(fsp_chunk_refs_spill(ctx) < 0)
+      return -1;
+  }
+  if(ctx->ring_mode) {
+    if(fsp_ring_linearize(ctx) < 0)
+      return -1;
+  }
+
+  /* Serialize from the keep mark when one holds bytes behind the read
+   * position, so an in-progress token survives the move */
+  base = fsp_keep_position(ctx);
+  backlog = (ctx->data_length - base) +
+            (ctx->spill_length - ctx->spill_read);
+
+  if(ctx->ring_mode)
+    flags |= FSP_CHECKPOINT_FLAG_RING;
+  if(ctx->more_chunks_expected)
+    flags |= FSP_CHECKPOINT_FLAG_MORE;
+  if(ctx->keep_from != (size_t)-1)
+    flags |= FSP_CHECKPOINT_FLAG_KEEP;
+
+  memcpy(header, FSP_CHECKPOINT_MAGIC, 4);
+  header[4] = FSP_CHECKPOINT_VERSION;
+  header[5] = flags;
+  header[6] = 0;
+  header[7] = 0;
+  fsp_checkpoint_put_u64(header + 8, ctx->config.initial_buffer_size);
+  fsp_checkpoint_put_u64(header + 16, ctx->config.max_buffer_size);
+  fsp_checkpoint_put_u64(header + 24, ctx->config.growth_factor);
+  fsp_checkpoint_put_u64(header + 32, ctx->config.growth_increment);
+  fsp_checkpoint_put_u64(header + 40, ctx->config.shrink_threshold);
+  fsp_checkpoint_put_u64(header + 48, ctx->config.spill_threshold);
+  fsp_checkpoint_put_u64(header + 56, ctx->stream_consumed + base);
+  fsp_checkpoint_put_u64(header + 64, ctx->keep_from);
+  fsp_checkpoint_put_u64(header + 72, ctx->read_position - base);
+  fsp_checkpoint_put_u64(header + 80, backlog);
+
+  if(writer(user_data, (const char*)header, sizeof(header)))
+    return -1;
+
+  if(ctx->data_length > base) {
+    if(writer(user_data, ctx->stream_buffer + base,
+              ctx->data_length - base))
+      return -1;
+  }
+
+#ifdef FSP_HAVE_SPILL
+  /* Stream the spilled backlog straight from the file, after the
+   * in-RAM bytes (matching the order reads serve them) */
+  if(ctx->spill_read < ctx->spill_length) {
+    char chunk[4096];
+    size_t offset = ctx->spill_read;
+
+    while(offset < ctx->spill_length) {
+      size_t want = ctx->spill_length - offset;
+      ssize_t got;
+
+      if(want > sizeof(chunk))
+        want = sizeof(chunk);
+
+      got = pread(ctx->spill_fd, chunk, want, (off_t)offset);
+      if(got <= 0) {
+        if(got < 0 && errno == EINTR)
+          continue;
+        return -1;
+      }
+
+      if(writer(user_data, chunk, (size_t)got))
+        return -1;
+      offset += (size_t)got;
+    }
   }
+#endif
 
-  free(ctx);
+  return 0;
 }
 
 
 /**
- * fsp_read_input - Read input data from the context
+ * fsp_restore - Rebuild a context from an fsp_checkpoint() snapshot
  *
- * @user_data: User data pointer
- * @buffer: Buffer to fill with data
- * @max_size: Maximum bytes to read
+ * @reader: Source hook invoked to read the checkpoint bytes, in order
+ * @user_data: Opaque pointer passed to @reader
  *
- * Returns: Number of bytes read, or 0 for EOF
+ * Creates a fresh context and replays the serialized streaming state
+ * into it: configuration, unread backlog (re-spilling to disk past
+ * the configured threshold), read position, keep mark, absolute
+ * stream offsets and end-of-input flag.  The host restores its own
+ * parser/lexer snapshot from the bytes following the fsp payload,
+ * then resumes feeding chunks from the checkpointed byte offset.
+ *
+ * Returns: The restored context, or NULL on failure (@reader failed,
+ * the bytes are not a supported checkpoint, or out of memory)
  */
-int
-fsp_read_input(void *user_data, char *buffer, size_t max_size)
+fsp_context*
+fsp_restore(fsp_checkpoint_reader reader, void *user_data)
 {
-  fsp_context *ctx = (fsp_context*)user_data;
-  size_t available;
-  size_t to_copy;
+  unsigned char header[FSP_CHECKPOINT_HEADER_SIZE];
+  fsp_config config;
+  fsp_context *ctx;
+  unsigned char flags;
+  size_t keep_from;
+  size_t rel_read;
+  size_t backlog;
 
-  if(!ctx || !buffer || max_size == 0)
-    return 0;
+  if(!reader)
+    return NULL;
 
-  /* Calculate available unread data */
-  available = ctx->data_length - ctx->read_position;
+  if(reader(user_data, (char*)header, sizeof(header)))
+    return NULL;
 
-  if(available == 0) {
-    /* No more data in buffer */
-    if(ctx->more_chunks_expected) {
-      /* More chunks will come - return 0 to signal "would block" */
-      return 0;
-    } else {
-      /* True EOF - no more data will ever come */
-      return 0;
+  if(memcmp(header, FSP_CHECKPOINT_MAGIC, 4) ||
+     header[4] != FSP_CHECKPOINT_VERSION)
+    return NULL;
+  flags = header[5];
+
+  fsp_config_init(&config);
+  config.initial_buffer_size = fsp_checkpoint_get_u64(header + 8);
+  config.max_buffer_size = fsp_checkpoint_get_u64(header + 16);
+  config.growth_factor = fsp_checkpoint_get_u64(header + 24);
+  config.growth_increment = fsp_checkpoint_get_u64(header + 32);
+  config.shrink_threshold = fsp_checkpoint_get_u64(header + 40);
+  config.spill_threshold = fsp_checkpoint_get_u64(header + 48);
+
+  keep_from = fsp_checkpoint_get_u64(header + 64);
+  rel_read = fsp_checkpoint_get_u64(header + 72);
+  backlog = fsp_checkpoint_get_u64(header + 80);
+
+  ctx = fsp_create_with_config(&config);
+  if(!ctx)
+    return NULL;
+
+  ctx->stream_consumed = fsp_checkpoint_get_u64(header + 56);
+  ctx->more_chunks_expected = (flags & FSP_CHECKPOINT_FLAG_MORE) ? 1 : 0;
+
+  /* Arm the keep mark before replaying the backlog so growth along
+   * the way preserves the marked bytes */
+  if(flags & FSP_CHECKPOINT_FLAG_KEEP)
+    ctx->keep_from = keep_from;
+
+  while(backlog > 0) {
+    char chunk[4096];
+    size_t want = backlog;
+
+    if(want > sizeof(chunk))
+      want = sizeof(chunk);
+
+    if(reader(user_data, chunk, want) ||
+       fsp_buffer_append(ctx, chunk, want) < 0) {
+      fsp_destroy(ctx);
+      return NULL;
     }
+    backlog -= want;
+  }
+
+  /* The read position only trails the serialized base when a keep
+   * mark was set, which excludes spilling - so it always lands within
+   * the in-RAM bytes */
+  if(rel_read > ctx->data_length) {
+    fsp_destroy(ctx);
+    return NULL;
   }
+  ctx->read_position = rel_read;
 
-  /* Copy available data to caller's buffer */
-  to_copy = (available < max_size) ? available : max_size;
-  memcpy(buffer, ctx->stream_buffer + ctx->read_position, to_copy);
-  ctx->read_position += to_copy;
+  if(flags & FSP_CHECKPOINT_FLAG_RING) {
+    if(fsp_set_ring_buffer(ctx, 1) < 0) {
+      fsp_destroy(ctx);
+      return NULL;
+    }
+  }
 
-  return (int)to_copy;
+  return ctx;
 }
 
 
 /**
- * fsp_buffer_append - Append data to the context's stream buffer
+ * fsp_attach_fd - Attach a readable file descriptor for fd-driven input
  *
- * @ctx: The context to append data to
- * @data: The data to append
- * @length: The length of the data to append
+ * @ctx: The context to attach the descriptor to
+ * @fd: A readable descriptor (socket, pipe, file), or -1 to detach
  *
- * Returns: 0 on success, -1 on failure
+ * Event-loop integration: instead of the host read()ing into its own
+ * buffer and calling fsp_parse_chunk(), attach the descriptor and call
+ * fsp_on_readable() whenever the event loop reports it readable.  The
+ * descriptor should be non-blocking; it is borrowed, never closed by
+ * the library, and stays attached across fsp_reset().
+ *
+ * Returns: 0 on success, -1 on failure (SPSC mode, or no POSIX I/O)
  */
 int
-fsp_buffer_append(fsp_context *ctx, const char *data, size_t length)
+fsp_attach_fd(fsp_context *ctx, int fd)
 {
-  size_t unread;
-  size_t new_capacity;
-  char *new_buffer;
+#ifdef FSP_HAVE_IO
+  if(!ctx || ctx->spsc_mode)
+    return -1;
 
-  if(!ctx || !data || length == 0)
-    return 0;
+  ctx->io_fd = fd;
+  return 0;
+#else
+  (void)ctx;
+  (void)fd;
+  return -1;
+#endif
+}
 
-  /* Check if we need to grow or compact buffer */
-  if(ctx->data_length + length > ctx->buffer_capacity) {
-    /* Compact buffer (move unread data to beginning) */
-    unread = ctx->data_length - ctx->read_position;
-    if(unread > 0) {
-      memmove(ctx->stream_buffer,
-              ctx->stream_buffer + ctx->read_position,
-              unread);
-    }
-    ctx->data_length = unread;
-    ctx->read_position = 0;
 
-    /* If still not enough space, grow buffer */
-    if(ctx->data_length + length > ctx->buffer_capacity) {
-      new_capacity = ctx->buffer_capacity * 2;
-      while(new_capacity < ctx->data_length + length) {
-        new_capacity *= 2;
+/**
+ * fsp_on_readable - Drain the attached descriptor into the stream buffer
+ *
+ * @ctx: The context whose descriptor became readable
+ *
+ * Reads from the fd attached with fsp_attach_fd() until it would
+ * block, read()ing directly into reserved stream buffer space - or
+ * readv()ing into the ring buffer's two free wrap segments - so the
+ * bytes are never staged in a host-side buffer.  End of file maps to
+ * the end of the stream and EAGAIN to "more chunks expected", exactly
+ * as if the host had called fsp_parse_chunk() itself.  Contexts with
+ * an input filter or spilled backlog route the bytes through the
+ * filter/spill paths transparently.
+ *
+ * With watermarks set the read loop stops at the high watermark and
+ * returns FSP_STATUS_WOULD_BLOCK; stop watching the descriptor until
+ * the drain callback fires.
+ *
+ * Returns: A status code, as fsp_parse_chunk()
+ */
+fsp_status
+fsp_on_readable(fsp_context *ctx)
+{
+#ifdef FSP_HAVE_IO
+  int at_end = 0;
+
+  if(!ctx || ctx->io_fd < 0 || ctx->spsc_mode)
+    return FSP_STATUS_ERROR;
+
+  while(!at_end) {
+    ssize_t n;
+
+    if(fsp_would_block(ctx, (size_t)1))
+      return FSP_STATUS_WOULD_BLOCK;
+
+    if(ctx->input_filter != FSP_FILTER_NONE ||
+       ctx->spill_read < ctx->spill_length ||
+       ctx->config.spill_threshold) {
+      /* Filtered or spilling contexts must route new bytes through
+       * the append entry points, so stage one chunk on the stack */
+      char chunk[FSP_IO_READ_SIZE];
+
+      n = read(ctx->io_fd, chunk, sizeof(chunk));
+      if(n > 0) {
+        if(ctx->input_filter != FSP_FILTER_NONE) {
+          if(fsp_filter_append(ctx, chunk, (size_t)n) != 0)
+            return FSP_STATUS_ERROR;
+        } else if(fsp_buffer_append(ctx, chunk, (size_t)n) != 0)
+          return FSP_STATUS_NO_MEMORY;
+        continue;
       }
+    } else if(ctx->ring_mode &&
+              ctx->data_length < ctx->buffer_capacity) {
+      /* readv() straight into the ring's free space, split across the
+       * wrap point into (up to) two segments */
+      struct iovec iov[2];
+      int iovcnt = 1;
+      size_t write_position = (ctx->read_position + ctx->data_length) %
+                              ctx->buffer_capacity;
+      size_t space = ctx->buffer_capacity - ctx->data_length;
+      size_t first = ctx->buffer_capacity - write_position;
 
-      new_buffer = (char*)realloc(ctx->stream_buffer, new_capacity);
-      if(!new_buffer)
-        return -1; /* Out of memory */
+      if(first > space)
+        first = space;
+      iov[0].iov_base = ctx->stream_buffer + write_position;
+      iov[0].iov_len = first;
+      if(space > first) {
+        iov[1].iov_base = ctx->stream_buffer;
+        iov[1].iov_len = space - first;
+        iovcnt = 2;
+      }
 
-      ctx->stream_buffer = new_buffer;
-      ctx->buffer_capacity = new_capacity;
+      n = readv(ctx->io_fd, iov, iovcnt);
+      if(n > 0) {
+        size_t first_written = (size_t)n < first ? (size_t)n : first;
+
+        if(ctx->newline_index_enabled && !ctx->newline_suppress) {
+          if(fsp_newline_index_note(ctx, (char*)iov[0].iov_base,
+                                    first_written) < 0 ||
+             fsp_newline_index_note(ctx, ctx->stream_buffer,
+                                    (size_t)n - first_written) < 0)
+            return FSP_STATUS_NO_MEMORY;
+        }
+
+        ctx->data_length += (size_t)n;
+        ctx->stats.bytes_appended += (size_t)n;
+        fsp_stats_note_unread(ctx);
+        continue;
+      }
+    } else {
+      /* Linear mode (or a full ring, which reserve grows): read()
+       * directly into reserved buffer space and commit what arrived */
+      char *ptr;
+      size_t available;
+
+      if(fsp_buffer_reserve(ctx, FSP_IO_READ_SIZE, &ptr, &available) < 0)
+        return FSP_STATUS_NO_MEMORY;
+
+      n = read(ctx->io_fd, ptr, available);
+      if(n > 0) {
+        if(fsp_buffer_commit(ctx, (size_t)n) < 0)
+          return FSP_STATUS_ERROR;
+        continue;
+      }
+    }
+
+    if(n == 0) {
+      at_end = 1;
+      break;
     }
+    if(errno == EINTR)
+      continue;
+    if(errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    return FSP_STATUS_ERROR;
   }
 
-  /* Append data to buffer */
-  memcpy(ctx->stream_buffer + ctx->data_length, data, length);
-  ctx->data_length += length;
+  /* The compressed stream must be complete once the input ends */
+  if(at_end && ctx->input_filter != FSP_FILTER_NONE &&
+     ctx->filter_saw_input && !ctx->filter_at_end)
+    return FSP_STATUS_ERROR;
 
-  return 0;
+  return fsp_parse_committed(ctx, at_end);
+#else
+  (void)ctx;
+  return FSP_STATUS_ERROR;
+#endif
 }
 
 
 /**
- * fsp_buffer_compact - Compact the context's stream buffer
+ * fsp_set_parser_state - Attach the host's push parser state to the context
  *
- * @ctx: The context to compact
+ * @ctx: The context to attach the state to
+ * @parser_state: Opaque yypstate* from yypstate_new(), or NULL to detach
+ *
+ * Makes the parser state reachable from generated glue such as the
+ * batched driver (fsp_drive_parser()); the state is borrowed, never
+ * freed by the library.
  */
 void
-fsp_buffer_compact(fsp_context *ctx)
+fsp_set_parser_state(fsp_context *ctx, void *parser_state)
 {
-  size_t unread;
-
   if(!ctx)
     return;
 
-  unread = ctx->data_length - ctx->read_position;
-  if(unread > 0 && ctx->read_position > 0) {
-    memmove(ctx->stream_buffer,
-            ctx->stream_buffer + ctx->read_position,
-            unread);
-  }
-
-  ctx->data_length = unread;
-  ctx->read_position = 0;
+  ctx->parser_state = parser_state;
 }
 
 
 /**
- * fsp_buffer_available - Get the number of available bytes in the context's stream buffer
+ * fsp_get_parser_state - Get the host's attached push parser state
  *
- * @ctx: The context to get the available bytes from
+ * @ctx: The context to read from
  *
- * Returns: The number of available bytes
+ * Returns: The yypstate* set with fsp_set_parser_state(), or NULL
  */
-size_t
-fsp_buffer_available(fsp_context *ctx)
+void*
+fsp_get_parser_state(fsp_context *ctx)
 {
   if(!ctx)
-    return 0;
+    return NULL;
 
-  return ctx->data_length - ctx->read_position;
+  return ctx->parser_state;
 }
 
 
 /**
- * fsp_set_user_data - Set the user data pointer for the context
+ * fsp_set_lexer_scanner - Attach the host's reentrant lexer scanner
  *
- * @ctx: The context to set the user data pointer for
- * @user_data: The user data pointer to set
+ * @ctx: The context to attach the scanner to
+ * @scanner: Opaque yyscan_t from yylex_init(), or NULL to detach
+ *
+ * Companion to fsp_set_parser_state() for the lexer side; borrowed,
+ * never destroyed by the library.
  */
 void
-fsp_set_user_data(fsp_context *ctx, void *user_data)
+fsp_set_lexer_scanner(fsp_context *ctx, void *scanner)
 {
-  if(ctx)
-    ctx->user_data = user_data;
+  if(!ctx)
+    return;
+
+  ctx->lexer_scanner = scanner;
 }
 
 
 /**
- * fsp_get_user_data - Get the user data pointer for the context
+ * fsp_get_lexer_scanner - Get the host's attached lexer scanner
  *
- * @ctx: The context to get the user data pointer from
+ * @ctx: The context to read from
  *
- * Returns: The user data pointer
+ * Returns: The yyscan_t set with fsp_set_lexer_scanner(), or NULL
  */
 void*
-fsp_get_user_data(fsp_context *ctx)
+fsp_get_lexer_scanner(fsp_context *ctx)
 {
-  return ctx ? ctx->user_data : NULL;
+  if(!ctx)
+    return NULL;
+
+  return ctx->lexer_scanner;
 }
 
 
 /**
- * fsp_parse_chunk - Parse a chunk of input data
+ * fsp_stream_at_end - Test whether the end of the input stream was seen
  *
- * @ctx: The context to parse the chunk in
- * @chunk: The chunk of input data to parse
- * @length: The length of the chunk of input data to parse
- * @is_end: Whether this is the last chunk of input data
+ * @ctx: The context to test
  *
- * Returns: A status code
+ * True once a parse entry point was called with is_end set (or the
+ * attached fd reached end of file), telling driver glue that a lexer
+ * stall is the real end of input rather than a wait for more chunks.
+ *
+ * Returns: Non-zero at end of stream, 0 while more chunks are expected
  */
-fsp_status
-fsp_parse_chunk(fsp_context *ctx, const char *chunk, size_t length, int is_end)
+int
+fsp_stream_at_end(fsp_context *ctx)
 {
   if(!ctx)
-    return FSP_STATUS_ERROR;
+    return 0;
 
-  /* Append chunk to buffer */
-  if(fsp_buffer_append(ctx, chunk, length) != 0)
-    return FSP_STATUS_NO_MEMORY;
+  return !ctx->more_chunks_expected;
+}
 
-  /* Update EOF flag */
-  ctx->more_chunks_expected = !is_end;
 
-  /* Note: Actual parsing happens in host-specific code
-   * This is just the buffer management layer */
-  if(is_end && ctx->data_length > 0)
-    return FSP_STATUS_OK;
-  else if(!is_end)
-    return FSP_STATUS_NEED_DATA;
-  else
-    return FSP_STATUS_OK;
+/**
+ * fsp_set_parser_driver - Register the grammar-specific batched parse loop
+ *
+ * @ctx: The context to register the driver on
+ * @driver: The batched lex/push loop, or NULL to unregister
+ * @user_data: Opaque pointer passed to @driver
+ *
+ * The driver - generated into the parser by
+ * scripts/postprocess-bison.py --batch-driver, or hand-written to the
+ * same contract - runs the yylex/yypush_parse pair in a tight loop so
+ * fsp_drive_parser() amortizes the per-token call overhead of the
+ * host driving each pair itself.
+ */
+void
+fsp_set_parser_driver(fsp_context *ctx, fsp_parser_driver driver, void *user_data)
+{
+  if(!ctx)
+    return;
+
+  ctx->parser_driver = driver;
+  ctx->parser_driver_user_data = user_data;
 }
 
+
+/**
+ * fsp_drive_parser - Run the batched lex/push loop over buffered input
+ *
+ * @ctx: The context to drive
+ * @max_tokens: Stop after this many tokens; 0 or negative = unlimited
+ *
+ * Lexes and pushes tokens inside one call until the lexer runs out of
+ * buffered input, the parse finishes, or the token budget is hit -
+ * replacing the host's one-call-per-token loop.  Feed chunks with the
+ * parse entry points as usual, then call this instead of looping over
+ * yylex/yypush_parse.
+ *
+ * Returns: FSP_STATUS_NEED_DATA when the buffered input is exhausted
+ * mid-stream, FSP_STATUS_AGAIN when the budget was hit with more
+ * tokens pending, FSP_STATUS_OK when the parse accepted, or
+ * FSP_STATUS_ERROR (no driver registered, or the parse failed)
+ */
+fsp_status
+fsp_drive_parser(fsp_context *ctx, int max_tokens)
+{
+  if(!ctx || !ctx->parser_driver)
+    return FSP_STATUS_ERROR;
+
+  return ctx->parser_driver(ctx, max_tokens, ctx->parser_driver_user_data);
+}
@@ -28,12 +28,27 @@
 #include <fsp_config.h>
 #endif
 
+/* Embedded single-grammar builds can additionally define
+ * FSP_FIXED_BUFFER_SIZE, FSP_NO_GROWTH and/or FSP_ASSUME_VALID_CTX
+ * and include fsp_internal.h after this header to get the hot-path
+ * entry points as constant-folded inlines; see the specialization
+ * profile at the end of fsp_internal.h */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * fsp_status:
  * @FSP_STATUS_OK: Success, parsing complete
  * @FSP_STATUS_NEED_DATA: Need more input data
  * @FSP_STATUS_ERROR: Parse error
  * @FSP_STATUS_NO_MEMORY: Out of memory
+ * @FSP_STATUS_WOULD_BLOCK: Unread backlog is at the high watermark;
+ *   the chunk was not appended - stop feeding until the drain
+ *   callback fires (see fsp_set_watermarks())
+ * @FSP_STATUS_AGAIN: fsp_drive_parser() hit its token budget with
+ *   more tokens pending; call it again
  *
  * Status codes returned by fsp_parse_chunk()
  */
@@ -41,7 +56,9 @@ typedef enum {
   FSP_STATUS_OK = 0,
   FSP_STATUS_NEED_DATA,
   FSP_STATUS_ERROR,
-  FSP_STATUS_NO_MEMORY
+  FSP_STATUS_NO_MEMORY,
+  FSP_STATUS_WOULD_BLOCK,
+  FSP_STATUS_AGAIN
 } fsp_status;
 
 /**
@@ -63,20 +80,359 @@ typedef struct fsp_context_s fsp_context;
  */
 typedef int (*fsp_read_callback)(void *user_data, char *buffer, size_t max_size);
 
+/**
+ * fsp_iovec:
+ * @iov_base: Start of the fragment
+ * @iov_len: Length of the fragment in bytes
+ *
+ * Input fragment for the vectored entry points.  Field names and
+ * layout match the POSIX struct iovec (modulo constness) so callers
+ * holding iovec arrays can cast rather than repack.
+ */
+typedef struct fsp_iovec_s {
+  const char *iov_base;
+  size_t iov_len;
+} fsp_iovec;
+
+/**
+ * fsp_input_filter:
+ * @FSP_FILTER_NONE: Chunks are appended as-is (default)
+ * @FSP_FILTER_GZIP: Chunks are a gzip (or zlib) stream; needs zlib
+ * @FSP_FILTER_ZSTD: Chunks are a zstd stream; needs libzstd
+ *
+ * Transparent decompression stage selected with
+ * fsp_set_input_filter(): the parse entry points are fed compressed
+ * bytes and the filter decompresses them directly into the stream
+ * buffer
+ */
+typedef enum {
+  FSP_FILTER_NONE = 0,
+  FSP_FILTER_GZIP,
+  FSP_FILTER_ZSTD
+} fsp_input_filter;
+
+/**
+ * FSP_SIZE_ADAPTIVE:
+ *
+ * Value for fsp_config.initial_buffer_size selecting adaptive
+ * pre-sizing: the context starts at a learned percentile of the
+ * steady-state backlogs observed across previously destroyed
+ * contexts, skipping the realloc ladder a cold default would climb.
+ * Falls back to the 64KB default until enough contexts have been
+ * seen.
+ */
+#define FSP_SIZE_ADAPTIVE ((size_t)-1)
+
+/**
+ * fsp_config:
+ * @initial_buffer_size: Starting stream buffer capacity; 0 = default
+ *   (64KB), FSP_SIZE_ADAPTIVE = pre-size from observed backlogs
+ * @max_buffer_size: Hard capacity ceiling; 0 = unlimited
+ * @growth_factor: Capacity multiplier when growing; 0 = default (2)
+ * @growth_increment: When non-zero, grow linearly by this many bytes
+ *   instead of multiplying
+ * @shrink_threshold: When non-zero, fsp_buffer_compact() shrinks the
+ *   buffer back to this capacity once the unread backlog fits in it
+ * @spill_threshold: When non-zero, unread backlog past this many
+ *   in-RAM bytes overflows to an unlinked per-context temp file and is
+ *   transparently read back by fsp_read_input(), bounding resident
+ *   memory however large a single token grows
+ *
+ * Buffer sizing and growth policy for fsp_create_with_config().
+ * Initialize with fsp_config_init() then override selected fields.
+ */
+typedef struct fsp_config_s {
+  size_t initial_buffer_size;
+  size_t max_buffer_size;
+  size_t growth_factor;
+  size_t growth_increment;
+  size_t shrink_threshold;
+  size_t spill_threshold;
+} fsp_config;
+
+/**
+ * fsp_stats:
+ * @bytes_appended: Total bytes accepted into the stream buffer
+ * @bytes_read: Total bytes served to the lexer by fsp_read_input()
+ * @compactions: Times unread data was slid to the buffer start
+ * @compaction_bytes_moved: Total bytes moved by those compactions
+ * @buffer_grows: Times the stream buffer was reallocated larger
+ * @peak_buffer_capacity: Largest stream buffer capacity seen
+ * @read_stalls: Zero-byte fsp_read_input() returns (lexer waiting)
+ * @peak_unread: High-water mark of the unread byte backlog
+ *
+ * Hot-path counters maintained unconditionally with plain increments
+ * (no branches or locks); read them with fsp_get_stats().  Counters
+ * accumulate for the life of the context, across fsp_reset().
+ */
+typedef struct fsp_stats_s {
+  size_t bytes_appended;
+  size_t bytes_read;
+  size_t compactions;
+  size_t compaction_bytes_moved;
+  size_t buffer_grows;
+  size_t peak_buffer_capacity;
+  size_t read_stalls;
+  size_t peak_unread;
+} fsp_stats;
+
+/**
+ * fsp_trace_event:
+ * @FSP_TRACE_APPEND: Bytes entered the stream buffer
+ * @FSP_TRACE_COMPACT: Compaction moved unread bytes to the front
+ * @FSP_TRACE_READ: fsp_read_input() served bytes to the lexer
+ *   (0 bytes = a read stall)
+ * @FSP_TRACE_PARSE_CHUNK: fsp_parse_chunk() accepted a chunk
+ *
+ * Event ids for the compile-time tracing layer.  Build with
+ * -DFSP_TRACE=1 to compile the hooks in; without it the hot paths
+ * carry no tracing code at all and fsp_trace_enable() returns -1.
+ */
+typedef enum {
+  FSP_TRACE_APPEND = 1,
+  FSP_TRACE_COMPACT,
+  FSP_TRACE_READ,
+  FSP_TRACE_PARSE_CHUNK
+} fsp_trace_event;
+
+/**
+ * fsp_trace_record:
+ * @timestamp: rdtsc cycles on x86-64, CLOCK_MONOTONIC_RAW nanoseconds
+ *   elsewhere
+ * @sequence: Per-context event number starting at 1; a gap means the
+ *   ring was full and records were dropped
+ * @event: fsp_trace_event id
+ * @bytes: Payload bytes for the event
+ *
+ * One fixed-size hot-path trace event
+ */
+typedef struct fsp_trace_record_s {
+  unsigned long long timestamp;
+  unsigned long long sequence;
+  unsigned int event;
+  size_t bytes;
+} fsp_trace_record;
+
+/**
+ * fsp_trace_callback:
+ * @record: The drained record (valid only during the call)
+ * @user_data: User data pointer given to fsp_trace_drain()
+ *
+ * Invoked by fsp_trace_drain() once per buffered record, oldest first
+ */
+typedef void (*fsp_trace_callback)(const fsp_trace_record *record, void *user_data);
+
+/**
+ * fsp_allocator:
+ * @malloc_fn: malloc replacement
+ * @calloc_fn: calloc replacement
+ * @realloc_fn: realloc replacement
+ * @free_fn: free replacement
+ * @user_data: Opaque pointer passed to every hook
+ *
+ * Pluggable allocator vtable for fsp_set_allocator().  All library
+ * allocations go through these hooks; unset (NULL) hooks fall back to
+ * the libc functions.
+ */
+typedef struct fsp_allocator_s {
+  void* (*malloc_fn)(size_t size, void *user_data);
+  void* (*calloc_fn)(size_t nmemb, size_t size, void *user_data);
+  void* (*realloc_fn)(void *ptr, size_t size, void *user_data);
+  void (*free_fn)(void *ptr, void *user_data);
+  void *user_data;
+} fsp_allocator;
+
+/**
+ * fsp_reset_handler:
+ * @ctx: Context being reset
+ * @user_data: User data pointer given to fsp_set_reset_handler()
+ *
+ * Host hook invoked by fsp_reset() so the host can reinitialize its
+ * parser state and lexer scanner for the next document
+ *
+ * Return value: 0 on success, non-zero on failure
+ */
+typedef int (*fsp_reset_handler)(fsp_context *ctx, void *user_data);
+
+/**
+ * fsp_drain_callback:
+ * @ctx: Context whose backlog drained
+ * @user_data: User data pointer given to fsp_set_watermarks()
+ *
+ * Invoked from fsp_read_input() when a backpressured context's unread
+ * backlog falls to the low watermark, telling the host to resume
+ * reading its socket
+ */
+typedef void (*fsp_drain_callback)(fsp_context *ctx, void *user_data);
+
+/**
+ * fsp_parser_driver:
+ * @ctx: The context being driven
+ * @max_tokens: Token budget; 0 or negative = unlimited
+ * @user_data: User data pointer given to fsp_set_parser_driver()
+ *
+ * Grammar-specific batched lex/push loop registered with
+ * fsp_set_parser_driver() and invoked by fsp_drive_parser();
+ * generated by scripts/postprocess-bison.py --batch-driver
+ *
+ * Return value: A status code; FSP_STATUS_AGAIN when the budget was
+ * hit with more tokens pending
+ */
+typedef fsp_status (*fsp_parser_driver)(fsp_context *ctx, int max_tokens, void *user_data);
+
+/**
+ * fsp_checkpoint_writer:
+ * @user_data: User data pointer given to fsp_checkpoint()
+ * @data: Checkpoint bytes to write to the sink
+ * @length: Number of bytes to write
+ *
+ * Sink hook for fsp_checkpoint(); must write all @length bytes
+ *
+ * Return value: 0 on success, non-zero on failure
+ */
+typedef int (*fsp_checkpoint_writer)(void *user_data, const char *data, size_t length);
+
+/**
+ * fsp_checkpoint_reader:
+ * @user_data: User data pointer given to fsp_restore()
+ * @buffer: Buffer to fill from the checkpoint source
+ * @length: Exact number of bytes to read
+ *
+ * Source hook for fsp_restore(); must fill all @length bytes
+ *
+ * Return value: 0 on success, non-zero on failure
+ */
+typedef int (*fsp_checkpoint_reader)(void *user_data, char *buffer, size_t length);
+
+/**
+ * fsp_pool:
+ *
+ * Opaque multi-stream parser pool (fsp_pool_create()); parses many
+ * independent streams in parallel on worker threads
+ */
+typedef struct fsp_pool_s fsp_pool;
+
+/**
+ * fsp_pool_callback:
+ * @ctx: The stream's context, for driving the host lexer/parser
+ * @stream_id: Identifies which stream the chunk belonged to
+ * @status: Result of fsp_parse_chunk() for the chunk
+ * @user_data: User data pointer given to fsp_pool_create()
+ *
+ * Completion callback invoked on a pool worker thread after each
+ * submitted chunk is parsed; never concurrently for one stream
+ */
+typedef void (*fsp_pool_callback)(fsp_context *ctx, unsigned long stream_id, fsp_status status, void *user_data);
+
+/**
+ * fsp_sched:
+ *
+ * Opaque cooperative multi-stream scheduler (fsp_sched_create());
+ * round-robins many contexts on one thread, each getting a bounded
+ * fsp_drive_parser() token budget per turn, so one hot stream cannot
+ * starve the rest
+ */
+typedef struct fsp_sched_s fsp_sched;
+
 /* Core API */
 fsp_context* fsp_create(void);
+void fsp_config_init(fsp_config *config);
+fsp_context* fsp_create_with_config(const fsp_config *config);
 void fsp_destroy(fsp_context *ctx);
+int fsp_reset(fsp_context *ctx);
+void fsp_set_reset_handler(fsp_context *ctx, fsp_reset_handler handler, void *user_data);
 fsp_status fsp_parse_chunk(fsp_context *ctx, const char *chunk, size_t length, int is_end);
+fsp_status fsp_parse_chunk_borrowed(fsp_context *ctx, const char *chunk, size_t length, int is_end);
+fsp_status fsp_parse_chunk_iov(fsp_context *ctx, const fsp_iovec *iov, int iovcnt, int is_end);
+fsp_status fsp_parse_file(fsp_context *ctx, const char *filename);
+int fsp_attach_mapping(fsp_context *ctx, const char *ptr, size_t length);
 int fsp_read_input(void *user_data, char *buffer, size_t max_size);
 
+/* Event-loop integration (POSIX): epoll/kqueue readable -> fsp_on_readable() */
+int fsp_attach_fd(fsp_context *ctx, int fd);
+fsp_status fsp_on_readable(fsp_context *ctx);
+
+/* Batched push-parse driving (scripts/postprocess-bison.py --batch-driver) */
+void fsp_set_parser_state(fsp_context *ctx, void *parser_state);
+void* fsp_get_parser_state(fsp_context *ctx);
+void fsp_set_lexer_scanner(fsp_context *ctx, void *scanner);
+void* fsp_get_lexer_scanner(fsp_context *ctx);
+int fsp_stream_at_end(fsp_context *ctx);
+void fsp_set_parser_driver(fsp_context *ctx, fsp_parser_driver driver, void *user_data);
+fsp_status fsp_drive_parser(fsp_context *ctx, int max_tokens);
+
 /* Buffer management */
 int fsp_buffer_append(fsp_context *ctx, const char *data, size_t length);
+int fsp_buffer_append_iov(fsp_context *ctx, const fsp_iovec *iov, int iovcnt);
+int fsp_buffer_reserve(fsp_context *ctx, size_t min_size, char **ptr, size_t *available);
+int fsp_buffer_commit(fsp_context *ctx, size_t length);
+fsp_status fsp_parse_committed(fsp_context *ctx, int is_end);
 void fsp_buffer_compact(fsp_context *ctx);
+int fsp_set_keep_from(fsp_context *ctx, size_t offset);
 size_t fsp_buffer_available(fsp_context *ctx);
+int fsp_set_ring_buffer(fsp_context *ctx, int enable);
+int fsp_set_spsc(fsp_context *ctx, int enable);
+void fsp_set_watermarks(fsp_context *ctx, size_t high_watermark, size_t low_watermark, fsp_drain_callback callback, void *user_data);
 
 /* Configuration */
+int fsp_set_input_filter(fsp_context *ctx, fsp_input_filter filter);
 void fsp_set_user_data(fsp_context *ctx, void *user_data);
 void* fsp_get_user_data(fsp_context *ctx);
 
+/* SIMD-accelerated scanning (SSE2/AVX2/NEON, runtime-dispatched) */
+size_t fsp_scan_delims(const char *data, size_t length, int delim1, int delim2);
+size_t fsp_scan_input(fsp_context *ctx, int delim1, int delim2);
+
+/* Flex in-place scanning (yy_scan_buffer() integration; see also
+ * scripts/postprocess-flex.py --in-place-scan) */
+int fsp_scan_window(fsp_context *ctx, char **start, size_t *length);
+int fsp_scan_window_consume(fsp_context *ctx, size_t nbytes);
+
+/* Line/column tracking */
+int fsp_enable_newline_index(fsp_context *ctx, int enable);
+int fsp_position_for_offset(fsp_context *ctx, size_t offset, size_t *line, size_t *column);
+
+/* Statistics */
+void fsp_get_stats(fsp_context *ctx, fsp_stats *stats);
+
+/* Hot-path tracing (compile with -DFSP_TRACE=1) */
+int fsp_trace_enable(fsp_context *ctx, size_t capacity);
+size_t fsp_trace_drain(fsp_context *ctx, fsp_trace_callback callback, void *user_data);
+
+/* Checkpoint/restore for failover and migration */
+int fsp_checkpoint(fsp_context *ctx, fsp_checkpoint_writer writer, void *user_data);
+fsp_context* fsp_restore(fsp_checkpoint_reader reader, void *user_data);
+
+/* Multi-stream parser pool (fsp_pool.c); requires POSIX threads */
+fsp_pool* fsp_pool_create(int n_workers, fsp_pool_callback callback, void *user_data);
+int fsp_pool_submit(fsp_pool *pool, unsigned long stream_id, const char *chunk, size_t length, int is_end);
+int fsp_pool_flush(fsp_pool *pool);
+void fsp_pool_destroy(fsp_pool *pool);
+
+/* Cooperative multi-stream scheduler (fsp_sched.c); single-threaded,
+ * contexts need a parser driver (fsp_set_parser_driver) */
+fsp_sched* fsp_sched_create(void);
+void fsp_sched_destroy(fsp_sched *sched);
+int fsp_sched_add(fsp_sched *sched, fsp_context *ctx);
+int fsp_sched_remove(fsp_sched *sched, fsp_context *ctx);
+fsp_status fsp_sched_feed(fsp_sched *sched, fsp_context *ctx, const char *chunk, size_t length, int is_end);
+int fsp_sched_run(fsp_sched *sched, int budget);
+size_t fsp_sched_ready(fsp_sched *sched);
+
+/* Memory management - not thread-safe; configure before creating contexts */
+void fsp_set_allocator(const fsp_allocator *allocator);
+/* Built-in mmap-backed allocator for large stream buffers: 64-byte
+ * aligned payloads, MADV_HUGEPAGE above 2MB, mremap() growth */
+int fsp_use_mmap_allocator(size_t threshold);
+int fsp_set_context_pool_size(size_t max_contexts);
+
+/* Adaptive pre-sizing (FSP_SIZE_ADAPTIVE) */
+size_t fsp_adaptive_size(void);
+void fsp_adaptive_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* FSP_H */
 
@@ -0,0 +1,229 @@
+/* -*- Mode: c++; c-basic-offset: 2 -*-
+ *
+ * fsp.hpp - Header-only C++20 wrapper for libfsp
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifndef FSP_HPP
+#define FSP_HPP
+
+/* Zero-overhead C++ face over fsp.h: every member is a thin inline
+ * forwarder around the corresponding C call, so this compiles down to
+ * the same code as using the C API directly.  The point is to delete
+ * the copy-happy wrappers C++ services write by hand - in particular
+ * std::span arguments forward chunk and scatter/gather reads without
+ * an intermediate std::string.
+ *
+ * Requires C++20 (std::span).  With C++23 the fallible operations
+ * return std::expected; under C++20 a minimal source-compatible
+ * expected substitute is provided.  No exceptions are thrown anywhere.
+ */
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <version>
+
+#if defined(__cpp_lib_expected) && __cpp_lib_expected >= 202202L
+#include <expected>
+#define FSP_HPP_HAVE_EXPECTED 1
+#endif
+
+#include "fsp.h"
+
+namespace fsp {
+
+/* Scoped mirror of fsp_status; values are identical so conversion is
+ * a cast */
+enum class status {
+  ok = FSP_STATUS_OK,
+  need_data = FSP_STATUS_NEED_DATA,
+  parse_error = FSP_STATUS_ERROR,
+  no_memory = FSP_STATUS_NO_MEMORY,
+  would_block = FSP_STATUS_WOULD_BLOCK,
+  again = FSP_STATUS_AGAIN
+};
+
+#ifdef FSP_HPP_HAVE_EXPECTED
+
+template<typename T>
+using expected = std::expected<T, status>;
+
+using unexpected = std::unexpected<status>;
+
+#else
+
+/* C++20 stand-in for the std::expected<T, status> subset used here:
+ * has_value()/operator bool, value(), error() and implicit
+ * construction from a value or an unexpected error */
+struct unexpected {
+  status err;
+  constexpr explicit unexpected(status e) noexcept : err(e) {}
+};
+
+template<typename T>
+class expected {
+public:
+  constexpr expected(T v) noexcept : value_(std::move(v)), has_(true) {}
+  constexpr expected(unexpected u) noexcept : error_(u.err), has_(false) {}
+
+  constexpr bool has_value() const noexcept { return has_; }
+  constexpr explicit operator bool() const noexcept { return has_; }
+  constexpr T& value() noexcept { return value_; }
+  constexpr const T& value() const noexcept { return value_; }
+  constexpr T& operator*() noexcept { return value_; }
+  constexpr const T& operator*() const noexcept { return value_; }
+  constexpr T* operator->() noexcept { return &value_; }
+  constexpr const T* operator->() const noexcept { return &value_; }
+  constexpr status error() const noexcept { return error_; }
+
+private:
+  T value_{};
+  status error_{status::ok};
+  bool has_;
+};
+
+#endif /* FSP_HPP_HAVE_EXPECTED */
+
+/**
+ * fsp::context - Move-only RAII owner of an fsp_context
+ *
+ * Construction via the static create() factories; the destructor runs
+ * fsp_destroy().  A moved-from context is empty (operator bool is
+ * false) and safe to destroy or assign into.  Escape hatches to the C
+ * API are native_handle() and release().
+ */
+class context {
+public:
+  context() noexcept = default;
+
+  /* Adopt a raw handle (takes ownership) */
+  explicit context(fsp_context *ctx) noexcept : ctx_(ctx) {}
+
+  context(const context&) = delete;
+  context& operator=(const context&) = delete;
+
+  context(context&& other) noexcept
+    : ctx_(std::exchange(other.ctx_, nullptr)) {}
+
+  context& operator=(context&& other) noexcept {
+    if(this != &other) {
+      if(ctx_)
+        fsp_destroy(ctx_);
+      ctx_ = std::exchange(other.ctx_, nullptr);
+    }
+    return *this;
+  }
+
+  ~context() {
+    if(ctx_)
+      fsp_destroy(ctx_);
+  }
+
+  static expected<context> create() noexcept {
+    fsp_context *ctx = fsp_create();
+    if(!ctx)
+      return unexpected(status::no_memory);
+    return context(ctx);
+  }
+
+  static expected<context> create(const fsp_config& config) noexcept {
+    fsp_context *ctx = fsp_create_with_config(&config);
+    if(!ctx)
+      return unexpected(status::no_memory);
+    return context(ctx);
+  }
+
+  explicit operator bool() const noexcept { return ctx_ != nullptr; }
+
+  /* Feed one chunk; forwards the span's pointer/length, no copy */
+  status parse(std::span<const std::byte> chunk, bool last) noexcept {
+    return static_cast<status>(
+      fsp_parse_chunk(ctx_, reinterpret_cast<const char*>(chunk.data()),
+                      chunk.size(), last ? 1 : 0));
+  }
+
+  status parse(std::span<const char> chunk, bool last) noexcept {
+    return static_cast<status>(
+      fsp_parse_chunk(ctx_, chunk.data(), chunk.size(), last ? 1 : 0));
+  }
+
+  /* Serve buffered bytes into the caller's span (YY_INPUT semantics:
+   * 0 means stall or EOF) */
+  std::size_t read(std::span<std::byte> out) noexcept {
+    return static_cast<std::size_t>(
+      fsp_read_input(ctx_, reinterpret_cast<char*>(out.data()), out.size()));
+  }
+
+  std::size_t read(std::span<char> out) noexcept {
+    return static_cast<std::size_t>(
+      fsp_read_input(ctx_, out.data(), out.size()));
+  }
+
+  /* Reserve/commit path for copy-free socket reads: reserve() exposes
+   * writable buffer space as a span at least min_size long, the host
+   * reads into it (asio/readv/recv), then commit() publishes the bytes
+   * actually received.  See fsp_buffer_reserve(). */
+  expected<std::span<std::byte>> reserve(std::size_t min_size) noexcept {
+    char *ptr = nullptr;
+    std::size_t available = 0;
+
+    if(fsp_buffer_reserve(ctx_, min_size, &ptr, &available) != 0)
+      return unexpected(status::no_memory);
+    return std::span<std::byte>(reinterpret_cast<std::byte*>(ptr),
+                                available);
+  }
+
+  status commit(std::size_t length) noexcept {
+    if(fsp_buffer_commit(ctx_, length) != 0)
+      return status::parse_error;
+    return status::ok;
+  }
+
+  /* Run the installed push-parser driver for up to max_tokens tokens;
+   * status::again means budget exhausted with input left */
+  status drive(int max_tokens) noexcept {
+    return static_cast<status>(fsp_drive_parser(ctx_, max_tokens));
+  }
+
+  std::size_t available() const noexcept {
+    return fsp_buffer_available(ctx_);
+  }
+
+  void compact() noexcept { fsp_buffer_compact(ctx_); }
+
+  fsp_stats stats() const noexcept {
+    fsp_stats s;
+    fsp_get_stats(ctx_, &s);
+    return s;
+  }
+
+  /* Borrow the raw handle for C calls not wrapped here */
+  fsp_context* native_handle() const noexcept { return ctx_; }
+
+  /* Give up ownership without destroying */
+  fsp_context* release() noexcept { return std::exchange(ctx_, nullptr); }
+
+private:
+  fsp_context *ctx_ = nullptr;
+};
+
+} /* namespace fsp */
+
+#endif /* FSP_HPP */
@@ -0,0 +1,417 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * fsp_bench.c - Throughput benchmark harness for libfsp
+ *
+ * Generates synthetic workloads (tiny statements, long triple-quoted
+ * strings, a pure buffer-layer stream) and drives them through
+ * fsp_parse_chunk()/fsp_read_input() - and for the parser workloads
+ * the test_lexer.l/test_parser.y pipeline - at chunk sizes from 1 byte
+ * to 1MB, reporting MB/s, tokens/s and peak RSS.
+ *
+ * Usage: fsp_bench [-m] [-s SIZE_KB]
+ *   -m  machine-readable output (one key=value record per line)
+ *   -s  workload size in KB (default 1024)
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include "fsp.h"
+#include "fsp_internal.h"  /* For direct access to context internals */
+#include "test_parser.h"
+
+/* Define YYSTYPE for lexer header */
+#define YYSTYPE TEST_PARSER_STYPE
+
+#include "test_lexer.h"
+
+/* Chunk sizes exercised per workload: 1 byte to 1MB */
+static const size_t bench_chunk_sizes[] = {
+  1, 64, 1024, 64 * 1024, 1024 * 1024
+};
+#define BENCH_NUM_CHUNK_SIZES \
+  (sizeof(bench_chunk_sizes) / sizeof(bench_chunk_sizes[0]))
+
+/* Minimum buffered bytes before calling the lexer; see fsp_test.c */
+#define MIN_BUFFER_FOR_LEX 16
+
+static int machine_readable = 0;
+
+/* Prototypes */
+static double bench_now(void);
+static long bench_peak_rss(void);
+static char *bench_gen_tiny(size_t target_size, size_t *length_p);
+static char *bench_gen_longstr(size_t target_size, size_t *length_p);
+static long bench_run_parse(const char *input, size_t input_len,
+                            size_t chunk_size, fsp_stats *stats_out);
+static void bench_report(const char *name, size_t chunk_size,
+                         size_t bytes, double seconds, long tokens,
+                         const fsp_stats *stats);
+static void bench_buffer_workload(size_t target_size);
+static void bench_parse_workload(const char *name, const char *input,
+                                 size_t input_len);
+
+/* Monotonic timestamp in seconds */
+static double
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Peak RSS in kilobytes, or 0 when unavailable */
+static long
+bench_peak_rss(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+  struct rusage usage;
+
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+    return usage.ru_maxrss;
+#endif
+  return 0;
+}
+
+/* Generate a workload of many tiny statements */
+static char *
+bench_gen_tiny(size_t target_size, size_t *length_p)
+{
+  const char *stmt = "let v1 = 42; print \"hi\"; ";
+  size_t stmt_len = strlen(stmt);
+  size_t count = target_size / stmt_len + 1;
+  char *input;
+  size_t i;
+
+  input = (char*)malloc(count * stmt_len + 1);
+  if(!input)
+    return NULL;
+
+  for(i = 0; i < count; i++)
+    memcpy(input + i * stmt_len, stmt, stmt_len);
+  input[count * stmt_len] = '\0';
+
+  *length_p = count * stmt_len;
+  return input;
+}
+
+/* Generate a workload of long triple-quoted strings.  Strings are
+ * kept to 512 bytes each: the test lexer accumulates long-string
+ * bodies one character at a time, so very large strings measure that
+ * quadratic accumulation rather than the streaming layer. */
+static char *
+bench_gen_longstr(size_t target_size, size_t *length_p)
+{
+  const char *head = "print \"\"\"";
+  const char *tail = "\"\"\"; ";
+  size_t body_len = 512;
+  size_t stmt_len = strlen(head) + body_len + strlen(tail);
+  size_t count = target_size / stmt_len + 1;
+  char *input;
+  char *p;
+  size_t i;
+
+  input = (char*)malloc(count * stmt_len + 1);
+  if(!input)
+    return NULL;
+
+  p = input;
+  for(i = 0; i < count; i++) {
+    memcpy(p, head, strlen(head));
+    p += strlen(head);
+    memset(p, 'x', body_len);
+    p += body_len;
+    memcpy(p, tail, strlen(tail));
+    p += strlen(tail);
+  }
+  *p = '\0';
+
+  *length_p = (size_t)(p - input);
+  return input;
+}
+
+/* Stream the input through the full lexer/push-parser pipeline in
+ * chunks; returns the token count, or -1 on failure */
+static long
+bench_run_parse(const char *input, size_t input_len, size_t chunk_size,
+                fsp_stats *stats_out)
+{
+  fsp_context *ctx;
+  yyscan_t scanner;
+  test_parser_pstate *pstate;
+  size_t pos = 0;
+  long tokens = 0;
+  int failed = 0;
+
+  test_parser_reset();
+
+  ctx = fsp_create();
+  if(!ctx)
+    return -1;
+
+  if(test_lexer_lex_init(&scanner)) {
+    fsp_destroy(ctx);
+    return -1;
+  }
+  test_lexer_set_extra(ctx, scanner);
+
+  pstate = test_parser_pstate_new();
+  if(!pstate) {
+    test_lexer_lex_destroy(scanner);
+    fsp_destroy(ctx);
+    return -1;
+  }
+
+  while(pos < input_len) {
+    size_t chunk;
+    int is_eof;
+
+    chunk = input_len - pos;
+    if(chunk > chunk_size)
+      chunk = chunk_size;
+
+    if(fsp_buffer_append(ctx, input + pos, chunk) < 0) {
+      failed = 1;
+      break;
+    }
+    pos += chunk;
+
+    is_eof = (pos >= input_len);
+    if(is_eof)
+      ctx->more_chunks_expected = 0;
+
+    if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+      continue;
+
+    while(fsp_buffer_available(ctx) > 0 || is_eof) {
+      TEST_PARSER_STYPE lval;
+      int token;
+      int status;
+
+      if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+        break;
+
+      memset(&lval, 0, sizeof(lval));
+      token = test_lexer_lex(&lval, scanner);
+
+      if(token == 0)
+        break;
+
+      if(token == ERROR) {
+        if(lval.string)
+          free(lval.string);
+        failed = 1;
+        break;
+      }
+
+      tokens++;
+      status = test_parser_push_parse(pstate, token, &lval, ctx, scanner);
+      if(status != YYPUSH_MORE) {
+        if(status != 0)
+          failed = 1;
+        break;
+      }
+    }
+
+    if(failed)
+      break;
+  }
+
+  if(!failed)
+    (void)test_parser_push_parse(pstate, 0, NULL, ctx, scanner);
+
+  fsp_get_stats(ctx, stats_out);
+
+  test_parser_pstate_delete(pstate);
+  test_lexer_lex_destroy(scanner);
+  fsp_destroy(ctx);
+  test_parser_free_statements();
+
+  return failed ? -1 : tokens;
+}
+
+/* Print one result line.  Bytes-copied-per-byte-parsed counts every
+ * memcpy/memmove of payload the streaming layer performed (append,
+ * compaction moves and lexer reads) against the input size. */
+static void
+bench_report(const char *name, size_t chunk_size, size_t bytes,
+             double seconds, long tokens, const fsp_stats *stats)
+{
+  double mb_per_s = ((double)bytes / (1024.0 * 1024.0)) / seconds;
+  double copied_per_byte = 0.0;
+
+  if(stats && bytes > 0)
+    copied_per_byte = (double)(stats->bytes_appended +
+                               stats->compaction_bytes_moved +
+                               stats->bytes_read) / (double)bytes;
+
+  if(machine_readable) {
+    printf("bench=%s chunk=%zu bytes=%zu seconds=%.6f mb_per_s=%.2f "
+           "tokens_per_s=%.0f copied_per_byte=%.2f peak_rss_kb=%ld\n",
+           name, chunk_size, bytes, seconds, mb_per_s,
+           tokens > 0 ? (double)tokens / seconds : 0.0,
+           copied_per_byte, bench_peak_rss());
+  } else {
+    printf("%-10s chunk %8zu: %8.2f MB/s", name, chunk_size, mb_per_s);
+    if(tokens > 0)
+      printf("  %12.0f tokens/s", (double)tokens / seconds);
+    printf("  %.2f copies/byte", copied_per_byte);
+    printf("\n");
+  }
+}
+
+/* Pure buffer-layer workload: append/read cycles without the lexer */
+static void
+bench_buffer_workload(size_t target_size)
+{
+  size_t ci;
+  char *chunk_data;
+  char read_buffer[64 * 1024];
+
+  chunk_data = (char*)malloc(1024 * 1024);
+  if(!chunk_data)
+    return;
+  memset(chunk_data, 'b', 1024 * 1024);
+
+  for(ci = 0; ci < BENCH_NUM_CHUNK_SIZES; ci++) {
+    size_t chunk_size = bench_chunk_sizes[ci];
+    fsp_context *ctx;
+    size_t total = 0;
+    double start;
+    double elapsed;
+    fsp_stats stats;
+
+    ctx = fsp_create();
+    if(!ctx)
+      break;
+
+    start = bench_now();
+    while(total < target_size) {
+      size_t chunk = chunk_size;
+
+      if(chunk > target_size - total)
+        chunk = target_size - total;
+
+      if(fsp_buffer_append(ctx, chunk_data, chunk) < 0)
+        break;
+      total += chunk;
+
+      while(fsp_buffer_available(ctx) > 0) {
+        if(fsp_read_input(ctx, read_buffer, sizeof(read_buffer)) <= 0)
+          break;
+      }
+    }
+    elapsed = bench_now() - start;
+
+    fsp_get_stats(ctx, &stats);
+    bench_report("buffer", chunk_size, total, elapsed, 0, &stats);
+    fsp_destroy(ctx);
+  }
+
+  free(chunk_data);
+}
+
+/* Full-pipeline workload at each chunk size */
+static void
+bench_parse_workload(const char *name, const char *input, size_t input_len)
+{
+  size_t ci;
+
+  for(ci = 0; ci < BENCH_NUM_CHUNK_SIZES; ci++) {
+    size_t chunk_size = bench_chunk_sizes[ci];
+    size_t use_len = input_len;
+    double start;
+    double elapsed;
+    long tokens;
+    fsp_stats stats;
+
+    /* 1-byte chunks are pathological; keep the run time sane */
+    if(chunk_size == 1 && use_len > 64 * 1024)
+      use_len = 64 * 1024;
+
+    memset(&stats, 0, sizeof(stats));
+    start = bench_now();
+    tokens = bench_run_parse(input, use_len, chunk_size, &stats);
+    elapsed = bench_now() - start;
+
+    if(tokens < 0) {
+      fprintf(stderr, "fsp_bench: workload %s failed at chunk size %zu\n",
+              name, chunk_size);
+      continue;
+    }
+
+    bench_report(name, chunk_size, use_len, elapsed, tokens, &stats);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  size_t target_size = 1024 * 1024;  /* 1MB default */
+  char *input;
+  size_t input_len;
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-m")) {
+      machine_readable = 1;
+    } else if(!strcmp(argv[i], "-s") && i + 1 < argc) {
+      target_size = (size_t)atol(argv[++i]) * 1024;
+    } else {
+      fprintf(stderr, "Usage: %s [-m] [-s SIZE_KB]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  test_parser_set_quiet(1);
+
+  if(!machine_readable)
+    printf("libfsp benchmark (workload %zu KB)\n==================\n",
+           target_size / 1024);
+
+  bench_buffer_workload(target_size);
+
+  input = bench_gen_tiny(target_size, &input_len);
+  if(input) {
+    bench_parse_workload("tiny", input, input_len);
+    free(input);
+  }
+
+  input = bench_gen_longstr(target_size, &input_len);
+  if(input) {
+    bench_parse_workload("longstr", input, input_len);
+    free(input);
+  }
+
+  if(!machine_readable)
+    printf("peak RSS: %ld KB\n", bench_peak_rss());
+
+  return 0;
+}
@@ -0,0 +1,227 @@
+/* -*- Mode: c++; c-basic-offset: 2 -*-
+ *
+ * fsp_hpp_test.cpp - Test program for the C++ wrapper (fsp.hpp)
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "fsp.hpp"
+
+static int test_count = 0;
+static int test_failed = 0;
+
+#define TEST(name) do { \
+  test_count++; \
+  fprintf(stderr, "Test %d: %s ... ", test_count, name); \
+} while(0)
+
+#define PASS() do { \
+  fprintf(stderr, "PASS\n"); \
+} while(0)
+
+#define FAIL(msg) do { \
+  fprintf(stderr, "FAIL: %s\n", msg); \
+  test_failed++; \
+} while(0)
+
+/* The wrapper must stay pointer-sized and trivially relocatable */
+static_assert(sizeof(fsp::context) == sizeof(fsp_context*),
+              "fsp::context must add no state over the raw handle");
+static_assert(!std::is_copy_constructible_v<fsp::context>,
+              "fsp::context must be move-only");
+static_assert(std::is_nothrow_move_constructible_v<fsp::context>,
+              "fsp::context moves must not throw");
+
+int
+main(int argc, char *argv[])
+{
+  char readbuf[256];
+
+  (void)argc;
+  (void)argv;
+
+  fprintf(stderr, "libfsp C++ wrapper test suite\n");
+  fprintf(stderr, "=============================\n\n");
+
+  /* Test 1: Factory creation and RAII validity */
+  TEST("context::create() yields a valid context");
+  auto created = fsp::context::create();
+  if(!created || !*created) {
+    FAIL("create() failed");
+    fprintf(stderr, "\nCannot continue without a context\n");
+    return 1;
+  }
+  PASS();
+
+  fsp::context ctx = std::move(*created);
+
+  /* Test 2: span-based parse/read round trip, no copies */
+  TEST("parse(span) / read(span) round trip");
+  {
+    std::string_view chunk = "let a = 1;";
+
+    if(ctx.parse(std::span<const char>(chunk.data(), chunk.size()), false) !=
+       fsp::status::need_data) {
+      FAIL("parse did not report need_data");
+    } else if(ctx.available() != chunk.size()) {
+      FAIL("available() mismatch after parse");
+    } else {
+      std::size_t n = ctx.read(std::span<char>(readbuf, sizeof(readbuf)));
+
+      if(n != chunk.size() || memcmp(readbuf, chunk.data(), n) != 0)
+        FAIL("read back mismatch");
+      else
+        PASS();
+    }
+  }
+
+  /* Test 3: reserve/commit exposes buffer space as a writable span */
+  TEST("reserve()/commit() copy-free ingress");
+  {
+    auto space = ctx.reserve(64);
+
+    if(!space || space->size() < 64) {
+      FAIL("reserve failed or span too small");
+    } else {
+      const char payload[] = "print \"hi\";";
+      size_t payload_length = sizeof(payload) - 1;
+
+      memcpy(space->data(), payload, payload_length);
+      if(ctx.commit(payload_length) != fsp::status::ok) {
+        FAIL("commit failed");
+      } else {
+        std::size_t n = ctx.read(std::span<char>(readbuf, sizeof(readbuf)));
+
+        if(n != payload_length || memcmp(readbuf, payload, n) != 0)
+          FAIL("committed bytes did not come back");
+        else
+          PASS();
+      }
+    }
+  }
+
+  /* Test 4: committing more than was reserved is refused */
+  TEST("commit() overcommit refused");
+  {
+    auto space = ctx.reserve(16);
+
+    if(!space) {
+      FAIL("reserve failed");
+    } else if(ctx.commit(space->size() + 1) != fsp::status::parse_error) {
+      FAIL("oversized commit not refused");
+    } else {
+      PASS();
+    }
+  }
+
+  /* Test 5: byte-span overload and end-of-stream status */
+  TEST("parse(span<const std::byte>, last) reports ok");
+  {
+    const char tail[] = "print b;";
+    auto bytes = std::as_bytes(std::span<const char>(tail, sizeof(tail) - 1));
+
+    if(ctx.parse(bytes, true) != fsp::status::ok) {
+      FAIL("final chunk did not report ok");
+    } else {
+      std::size_t n = ctx.read(std::span<char>(readbuf, sizeof(readbuf)));
+
+      if(n != sizeof(tail) - 1)
+        FAIL("final chunk bytes missing");
+      else
+        PASS();
+    }
+  }
+
+  /* Test 6: move semantics transfer ownership; moved-from is empty */
+  TEST("move transfers the handle");
+  {
+    fsp_context *raw = ctx.native_handle();
+    fsp::context moved = std::move(ctx);
+
+    if(ctx || moved.native_handle() != raw) {
+      FAIL("ownership not transferred");
+    } else {
+      ctx = std::move(moved);
+      if(moved || ctx.native_handle() != raw)
+        FAIL("move-assign did not restore ownership");
+      else
+        PASS();
+    }
+  }
+
+  /* Test 7: release() hands the raw handle back to the C API */
+  TEST("release() detaches for C interop");
+  {
+    fsp_context *raw = ctx.release();
+
+    if(!raw || ctx) {
+      FAIL("release left the wrapper engaged");
+      if(raw)
+        fsp_destroy(raw);
+    } else {
+      if(fsp_buffer_append(raw, "x", 1) != 0)
+        FAIL("released handle unusable");
+      else
+        PASS();
+      fsp_destroy(raw);
+    }
+  }
+
+  /* Test 8: stats are readable through the wrapper */
+  TEST("stats() reflects traffic");
+  {
+    auto made = fsp::context::create();
+
+    if(!made) {
+      FAIL("create() failed");
+    } else {
+      fsp::context c2 = std::move(*made);
+
+      (void)c2.parse(std::span<const char>("let q = 2;", 10), true);
+      (void)c2.read(std::span<char>(readbuf, sizeof(readbuf)));
+      fsp_stats stats = c2.stats();
+      if(stats.bytes_appended != 10 || stats.bytes_read != 10)
+        FAIL("stats counters wrong");
+      else
+        PASS();
+    }
+  }
+
+  /* Summary */
+  fprintf(stderr, "\n==================\n");
+  fprintf(stderr, "Tests run: %d\n", test_count);
+  fprintf(stderr, "Tests passed: %d\n", test_count - test_failed);
+  fprintf(stderr, "Tests failed: %d\n", test_failed);
+
+  if(test_failed > 0) {
+    fprintf(stderr, "\nFAILED\n");
+    return 1;
+  }
+
+  fprintf(stderr, "\nAll tests passed\n");
+  return 0;
+}
@@ -29,11 +29,35 @@
 
 #include "fsp.h"
 
+/* Allocation functions routing through the allocator installed with
+ * fsp_set_allocator(); unset hooks fall back to libc */
+void* fsp_alloc_malloc(size_t size);
+void* fsp_alloc_calloc(size_t nmemb, size_t size);
+void* fsp_alloc_realloc(void *ptr, size_t size);
+void fsp_alloc_free(void *ptr);
+
 /* Memory allocation macros with type casts for C++ compatibility */
-#define FSP_MALLOC(type, size) (type)malloc(size)
-#define FSP_CALLOC(type, nmemb, size) (type)calloc(nmemb, size)
-#define FSP_REALLOC(type, ptr, size) (type)realloc(ptr, size)
-#define FSP_FREE(type, ptr) free((void*)ptr)
+#define FSP_MALLOC(type, size) (type)fsp_alloc_malloc(size)
+#define FSP_CALLOC(type, nmemb, size) (type)fsp_alloc_calloc(nmemb, size)
+#define FSP_REALLOC(type, ptr, size) (type)fsp_alloc_realloc(ptr, size)
+#define FSP_FREE(type, ptr) fsp_alloc_free((void*)ptr)
+
+/* Embedded small-document buffer: stream_buffer points at this inline
+ * storage from creation until growth needs more, so contexts parsing
+ * small documents never touch the heap for buffer space.  Tune at
+ * build time with -DFSP_INLINE_BUFFER_SIZE=<bytes> (must be > 0). */
+#ifndef FSP_INLINE_BUFFER_SIZE
+#define FSP_INLINE_BUFFER_SIZE 4096
+#endif
+
+/* Reference to a caller-owned chunk used by the zero-copy mode
+ * (fsp_parse_chunk_borrowed).  The bytes are NOT copied; the caller
+ * must keep them valid until they have been fully consumed. */
+typedef struct fsp_chunk_ref_s {
+  const char *data;                /* Caller-owned bytes */
+  size_t length;                   /* Total bytes in the chunk */
+  size_t consumed;                 /* Bytes already served to the lexer */
+} fsp_chunk_ref;
 
 struct fsp_context_s {
   /* Bison push parser state (to be set by host) */
@@ -43,22 +67,272 @@ struct fsp_context_s {
   /* Flex lexer state (to be set by host) */
   void *lexer_scanner;             /* yyscan_t from reentrant scanner */
 
-  /* Streaming byte buffer */
+  /* Streaming byte buffer.  In the default linear mode data_length is
+   * the total bytes stored (consumed and unread) and read_position the
+   * next unread offset; compaction slides unread bytes to offset 0.
+   * In ring mode (fsp_set_ring_buffer()) the buffer is circular:
+   * read_position is the ring start, data_length counts only unread
+   * bytes, and reclaiming consumed space is a pointer update. */
   char *stream_buffer;             /* Accumulated input bytes */
   size_t buffer_capacity;          /* Total allocated size */
   size_t data_length;              /* Bytes currently in buffer */
   size_t read_position;            /* Current read position for YY_INPUT */
+  int ring_mode;                   /* 0 = linear (default), 1 = circular */
+
+  /* Keep-bytes compaction contract (fsp_set_keep_from): absolute
+   * stream offset of the earliest byte still referenced by the host
+   * lexer's in-progress token, or (size_t)-1 for no mark.  Compaction
+   * preserves bytes from the mark even when they are behind
+   * read_position.  stream_consumed is the absolute stream offset of
+   * stream_buffer[0] - the coordinate the mark is resolved against. */
+  size_t keep_from;                /* Keep mark; (size_t)-1 = unset */
+  size_t stream_consumed;          /* Stream offset of stream_buffer[0] */
+
+  /* Borrowed (zero-copy) chunk references; served after any bytes
+   * already in stream_buffer.  Appending while references are pending
+   * first spills the unconsumed borrowed bytes into stream_buffer so
+   * byte order is always preserved. */
+  fsp_chunk_ref *chunk_refs;       /* Array of pending references */
+  size_t chunk_refs_count;         /* Used entries in chunk_refs */
+  size_t chunk_refs_capacity;      /* Allocated entries in chunk_refs */
+  size_t chunk_refs_head;          /* First not-fully-consumed entry */
+
+  /* Single-producer/single-consumer handoff mode (fsp_set_spsc).  The
+   * stream buffer becomes a fixed-capacity lock-free ring: the
+   * producer thread owns spsc_write_position, the consumer thread owns
+   * spsc_read_position, and each publishes its index with a release
+   * store that the other side reads with an acquire load (fsp.c only
+   * ever touches these through atomic builtins).  One slot is kept
+   * empty so write == read always means empty.  The capacity is fixed
+   * while the mode is enabled - a full ring fails the append. */
+  int spsc_mode;                   /* 0 = off, 1 = SPSC ring active */
+  size_t spsc_write_position;      /* Producer index (next byte to write) */
+  size_t spsc_read_position;       /* Consumer index (next byte to read) */
+
+  /* Incremental newline index (fsp_enable_newline_index): sorted
+   * stream offsets of '\n' bytes, appended with a vectorized scan as
+   * data enters the stream; fsp_position_for_offset() binary-searches
+   * it.  Offsets count from the enable point. */
+  int newline_index_enabled;
+  int newline_suppress;            /* Spill in progress; already indexed */
+  size_t *newline_offsets;         /* Sorted '\n' stream offsets */
+  size_t newline_count;            /* Used entries in newline_offsets */
+  size_t newline_capacity;         /* Allocated entries */
+  size_t newline_stream_length;    /* Stream bytes indexed so far */
+
+  /* Spill-to-disk overflow (fsp_config.spill_threshold): unread
+   * backlog past the threshold is written to an unlinked per-context
+   * temp file and fsp_read_input() faults it back in sequentially,
+   * after the buffered bytes and ahead of borrowed references.  The
+   * file rewinds once fully drained. */
+  int spill_fd;                    /* Spill file, or -1 */
+  size_t spill_length;             /* Bytes written to the spill file */
+  size_t spill_read;               /* Bytes read back from it */
+
+  /* Event-loop integration (fsp_attach_fd): readable file descriptor
+   * that fsp_on_readable() drains with read()/readv() directly into
+   * the stream buffer.  Borrowed, never closed by the library. */
+  int io_fd;                       /* Attached fd, or -1 */
+
+  /* Transparent decompression stage (fsp_set_input_filter): the parse
+   * entry points feed compressed bytes to the filter, which inflates
+   * them directly into reserved stream buffer space instead of through
+   * a host-side intermediate buffer. */
+  int input_filter;                /* fsp_input_filter value */
+  void *filter_state;              /* z_stream* / ZSTD_DStream*, or NULL */
+  int filter_at_end;               /* Compressed stream end reached */
+  int filter_saw_input;            /* Any compressed bytes fed yet */
 
   /* State flags */
   int more_chunks_expected;        /* 0 = EOF, 1 = more coming */
   int initialization_done;         /* Track first-time setup */
 
+  /* Memory-mapped file input (fsp_parse_file); unmapped on destroy,
+   * reset or the next fsp_parse_file() call */
+  void *file_mapping;              /* mmap base, or NULL */
+  size_t file_mapping_length;      /* mmap length */
+
+  /* Batched lex/push loop (fsp_set_parser_driver); generated by
+   * scripts/postprocess-bison.py --batch-driver and invoked through
+   * fsp_drive_parser() */
+  fsp_parser_driver parser_driver;
+  void *parser_driver_user_data;
+
+  /* Reset hook (fsp_set_reset_handler) for host parser/lexer reinit */
+  fsp_reset_handler reset_handler;
+  void *reset_handler_user_data;
+
+  /* Buffer sizing and growth policy (fsp_create_with_config) */
+  fsp_config config;
+
+  /* Backpressure watermarks (fsp_set_watermarks).  When the unread
+   * backlog reaches high_watermark the parse entry points refuse new
+   * chunks with FSP_STATUS_WOULD_BLOCK; once reads drain the backlog
+   * to low_watermark the drain callback tells the host to resume. */
+  size_t high_watermark;           /* 0 = backpressure disabled */
+  size_t low_watermark;            /* Resume level for drain_callback */
+  fsp_drain_callback drain_callback;
+  void *drain_callback_user_data;
+  int backpressured;               /* 1 between refusal and drain */
+
+  /* Hot-path instrumentation (fsp_get_stats) */
+  fsp_stats stats;
+
+#ifdef FSP_TRACE
+  /* Hot-path trace ring (fsp_trace_enable): single-writer SPSC.
+   * Emits publish trace_write with a release store so a drain running
+   * on another thread only sees complete records; capacity is a power
+   * of two so indexes wrap with a mask.  A full ring drops the newest
+   * record - the sequence gap makes the loss visible. */
+  fsp_trace_record *trace_records; /* Ring storage, or NULL */
+  size_t trace_capacity;           /* Ring size in records (power of 2) */
+  size_t trace_write;              /* Producer index (published) */
+  size_t trace_read;               /* Consumer index (published) */
+  unsigned long long trace_sequence;
+#endif
+
   /* User data */
   void *user_data;                 /* Opaque pointer for callbacks */
+
+  /* Context pool freelist link (fsp_set_context_pool_size) */
+  struct fsp_context_s *pool_next;
+
+  /* Cooperative scheduler membership (fsp_sched.c): the owning
+   * scheduler, the doubly-linked registration list and the FIFO
+   * ready-queue link.  Idle contexts sit only on the registration
+   * list, so they cost the scheduler nothing per round. */
+  void *sched;                     /* Owning fsp_sched, or NULL */
+  struct fsp_context_s *sched_registered_next;
+  struct fsp_context_s *sched_registered_prev;
+  struct fsp_context_s *sched_ready_next;
+  int sched_ready;                 /* 1 = on the ready queue */
+
+  /* Inline small-buffer storage; kept last so the hot fields above
+   * stay within the leading cache lines.  stream_buffer points here
+   * until the backlog outgrows it and promotes to the heap. */
+  char inline_buffer[FSP_INLINE_BUFFER_SIZE];
 };
 
 /* Internal buffer management */
 int fsp_buffer_grow(fsp_context *ctx, size_t needed);
 
+
+/* Compile-time specialization profile for embedded single-grammar
+ * builds.  A host that links libfsp into one binary with exactly one
+ * grammar and known chunk sizes can define any of:
+ *
+ *   FSP_FIXED_BUFFER_SIZE=<bytes>  Buffer capacity is this
+ *                                  compile-time constant; implies
+ *                                  FSP_NO_GROWTH.  Must not exceed
+ *                                  FSP_INLINE_BUFFER_SIZE so the
+ *                                  context's inline storage is the
+ *                                  whole buffer, and contexts must be
+ *                                  created with an initial_buffer_size
+ *                                  of at least this value.
+ *   FSP_NO_GROWTH                  Growth policy checks are compiled
+ *                                  out; an append that does not fit
+ *                                  after compaction fails.
+ *   FSP_ASSUME_VALID_CTX           NULL-pointer guards are compiled
+ *                                  out; the caller guarantees live
+ *                                  arguments.
+ *
+ * and include this header after fsp.h in its lexer/driver translation
+ * units.  fsp_read_input() and fsp_buffer_append() are then remapped
+ * to the static inline fast paths below so the compiler can
+ * constant-fold the capacity and inline the copies into YY_INPUT.
+ *
+ * The fast paths cover the plain linear buffer only: contexts using
+ * ring/SPSC mode, borrowed chunks, spill, input filters, keep marks
+ * or watermarks must keep the out-of-line entry points, and the
+ * inline paths do not maintain the fsp_get_stats() counters. */
+#if defined(FSP_FIXED_BUFFER_SIZE) && !defined(FSP_NO_GROWTH)
+#define FSP_NO_GROWTH 1
+#endif
+
+#if defined(FSP_FIXED_BUFFER_SIZE) && \
+    (FSP_FIXED_BUFFER_SIZE > FSP_INLINE_BUFFER_SIZE)
+#error "FSP_FIXED_BUFFER_SIZE must not exceed FSP_INLINE_BUFFER_SIZE"
+#endif
+
+#if (defined(FSP_NO_GROWTH) || defined(FSP_ASSUME_VALID_CTX)) && \
+    !defined(FSP_BUILDING_LIBFSP)
+
+#include <string.h>  /* For the inline memcpy/memmove fast paths */
+
+#ifdef FSP_ASSUME_VALID_CTX
+#define FSP_SPEC_GUARD(condition, retval)
+#else
+#define FSP_SPEC_GUARD(condition, retval) \
+  do { if(condition) return retval; } while(0)
+#endif
+
+#ifdef FSP_FIXED_BUFFER_SIZE
+#define FSP_SPEC_CAPACITY(ctx) ((size_t)(FSP_FIXED_BUFFER_SIZE))
+#else
+#define FSP_SPEC_CAPACITY(ctx) ((ctx)->buffer_capacity)
+#endif
+
+static inline int
+fsp_read_input_specialized(void *user_data, char *buffer, size_t max_size)
+{
+  fsp_context *ctx = (fsp_context*)user_data;
+  size_t available;
+
+  FSP_SPEC_GUARD(!ctx, 0);
+
+  available = ctx->data_length - ctx->read_position;
+  if(available > max_size)
+    available = max_size;
+
+  memcpy(buffer, ctx->stream_buffer + ctx->read_position, available);
+  ctx->read_position += available;
+
+  return (int)available;
+}
+
+static inline int
+fsp_buffer_append_specialized(fsp_context *ctx, const char *data,
+                              size_t length)
+{
+  FSP_SPEC_GUARD(!ctx || !data || length == 0, 0);
+
+  if(ctx->data_length + length > FSP_SPEC_CAPACITY(ctx)) {
+    /* Reclaim consumed bytes - the steady-state fixup */
+    size_t unread = ctx->data_length - ctx->read_position;
+
+    memmove(ctx->stream_buffer, ctx->stream_buffer + ctx->read_position,
+            unread);
+    ctx->stream_consumed += ctx->read_position;
+    ctx->data_length = unread;
+    ctx->read_position = 0;
+
+    if(unread + length > FSP_SPEC_CAPACITY(ctx)) {
+#ifdef FSP_NO_GROWTH
+      return -1; /* Fixed capacity and the chunk does not fit */
+#else
+      /* Rare: hand the oversized append to the general growth path.
+       * This resolves to the out-of-line function - the remap macros
+       * are defined below this point. */
+      return fsp_buffer_append(ctx, data, length);
+#endif
+    }
+  }
+
+  memcpy(ctx->stream_buffer + ctx->data_length, data, length);
+  ctx->data_length += length;
+
+  return 0;
+}
+
+/* Route calls made after this point to the inline fast paths */
+#undef fsp_read_input
+#define fsp_read_input(user_data, buffer, max_size) \
+  fsp_read_input_specialized(user_data, buffer, max_size)
+#undef fsp_buffer_append
+#define fsp_buffer_append(ctx, data, length) \
+  fsp_buffer_append_specialized(ctx, data, length)
+
+#endif /* specialization profile and !FSP_BUILDING_LIBFSP */
+
 #endif /* FSP_INTERNAL_H */
 
@@ -0,0 +1,278 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * fsp_perf_check.c - Correctness + throughput floor checker for
+ * large synthetic workloads
+ *
+ * Streams a workload file (see tests/gen_workload.c) through the full
+ * lexer/push-parser pipeline at a configurable chunk size, without
+ * ever holding the whole input in memory, and fails unless both hold:
+ * every statement parsed cleanly (optionally matching an exact
+ * expected count) and throughput stayed above a configurable MB/s
+ * floor.  This is the safety net the perf-check GNUMakefile target
+ * runs against multi-MB inputs that make check never touches.
+ *
+ * Usage: fsp_perf_check [-c CHUNK_BYTES] [-m MIN_MBPS] [-n STATEMENTS] FILE
+ *   -c  chunk size fed per fsp_buffer_append() call (default 4096)
+ *   -m  minimum MB/s accepted; 0 disables the floor (default 0)
+ *   -n  exact statement count expected; -1 skips the check (default -1)
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsp.h"
+#include "fsp_internal.h"  /* For direct access to context internals */
+#include "test_parser.h"
+
+/* Define YYSTYPE for lexer header */
+#define YYSTYPE TEST_PARSER_STYPE
+
+#include "test_lexer.h"
+
+/* Minimum buffered bytes before calling the lexer; see fsp_test.c */
+#define MIN_BUFFER_FOR_LEX 16
+
+/* Prototypes */
+static double perf_now(void);
+static long perf_count_and_free_statements(void);
+static long perf_run_file(FILE *fp, size_t chunk_size, size_t *bytes_p);
+
+/* Monotonic timestamp in seconds */
+static double
+perf_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Tally and release completed statements.  Freeing as we go keeps
+ * memory flat on GB-scale inputs instead of accumulating the whole
+ * statement list for the final walk. */
+static long
+perf_count_and_free_statements(void)
+{
+  statement_node *node;
+  long count = 0;
+
+  for(node = test_parser_get_statements(); node; node = node->next)
+    count++;
+  test_parser_free_statements();
+
+  return count;
+}
+
+/* Stream the file through the lexer/push-parser pipeline chunk by
+ * chunk; returns the statement count, or -1 on parse failure */
+static long
+perf_run_file(FILE *fp, size_t chunk_size, size_t *bytes_p)
+{
+  fsp_context *ctx;
+  yyscan_t scanner;
+  test_parser_pstate *pstate;
+  char *chunk;
+  long statements = 0;
+  int failed = 0;
+  int is_eof = 0;
+
+  *bytes_p = 0;
+
+  chunk = (char*)malloc(chunk_size);
+  if(!chunk)
+    return -1;
+
+  test_parser_reset();
+
+  ctx = fsp_create();
+  if(!ctx) {
+    free(chunk);
+    return -1;
+  }
+
+  if(test_lexer_lex_init(&scanner)) {
+    fsp_destroy(ctx);
+    free(chunk);
+    return -1;
+  }
+  test_lexer_set_extra(ctx, scanner);
+
+  pstate = test_parser_pstate_new();
+  if(!pstate) {
+    test_lexer_lex_destroy(scanner);
+    fsp_destroy(ctx);
+    free(chunk);
+    return -1;
+  }
+
+  while(!is_eof) {
+    size_t got = fread(chunk, 1, chunk_size, fp);
+
+    is_eof = (got < chunk_size);
+
+    if(got > 0) {
+      if(fsp_buffer_append(ctx, chunk, got) < 0) {
+        failed = 1;
+        break;
+      }
+      *bytes_p += got;
+    }
+
+    if(is_eof)
+      ctx->more_chunks_expected = 0;
+
+    if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+      continue;
+
+    while(fsp_buffer_available(ctx) > 0 || is_eof) {
+      TEST_PARSER_STYPE lval;
+      int token;
+      int status;
+
+      if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+        break;
+
+      memset(&lval, 0, sizeof(lval));
+      token = test_lexer_lex(&lval, scanner);
+
+      if(token == 0)
+        break;
+
+      if(token == ERROR) {
+        if(lval.string)
+          free(lval.string);
+        failed = 1;
+        break;
+      }
+
+      status = test_parser_push_parse(pstate, token, &lval, ctx, scanner);
+      if(status != YYPUSH_MORE) {
+        if(status != 0)
+          failed = 1;
+        break;
+      }
+    }
+
+    if(failed)
+      break;
+
+    statements += perf_count_and_free_statements();
+  }
+
+  if(!failed) {
+    if(test_parser_push_parse(pstate, 0, NULL, ctx, scanner) != 0)
+      failed = 1;
+    statements += perf_count_and_free_statements();
+  }
+
+  test_parser_pstate_delete(pstate);
+  test_lexer_lex_destroy(scanner);
+  fsp_destroy(ctx);
+  test_parser_free_statements();
+  free(chunk);
+
+  return failed ? -1 : statements;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *path = NULL;
+  size_t chunk_size = 4096;
+  double min_mbps = 0.0;
+  long expected_statements = -1;
+  long statements;
+  size_t bytes = 0;
+  double start;
+  double elapsed;
+  double mbps;
+  FILE *fp;
+  int failed = 0;
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-c") && i + 1 < argc)
+      chunk_size = (size_t)strtoul(argv[++i], NULL, 10);
+    else if(!strcmp(argv[i], "-m") && i + 1 < argc)
+      min_mbps = strtod(argv[++i], NULL);
+    else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+      expected_statements = strtol(argv[++i], NULL, 10);
+    else if(!path)
+      path = argv[i];
+    else {
+      path = NULL;
+      break;
+    }
+  }
+
+  if(!path || !chunk_size) {
+    fprintf(stderr,
+            "Usage: fsp_perf_check [-c CHUNK_BYTES] [-m MIN_MBPS] "
+            "[-n STATEMENTS] FILE\n");
+    return 1;
+  }
+
+  fp = fopen(path, "rb");
+  if(!fp) {
+    fprintf(stderr, "fsp_perf_check: cannot open %s\n", path);
+    return 1;
+  }
+
+  test_parser_set_quiet(1);
+
+  start = perf_now();
+  statements = perf_run_file(fp, chunk_size, &bytes);
+  elapsed = perf_now() - start;
+  fclose(fp);
+
+  if(elapsed <= 0.0)
+    elapsed = 1e-9;
+  mbps = ((double)bytes / (1024.0 * 1024.0)) / elapsed;
+
+  printf("%s chunk=%lu bytes=%lu statements=%ld time=%.3fs MB/s=%.2f\n",
+         path, (unsigned long)chunk_size, (unsigned long)bytes,
+         statements, elapsed, mbps);
+
+  if(statements < 0) {
+    fprintf(stderr, "fsp_perf_check: FAILED: parse error in %s\n", path);
+    failed = 1;
+  } else if(expected_statements >= 0 &&
+            statements != expected_statements) {
+    fprintf(stderr,
+            "fsp_perf_check: FAILED: %s: expected %ld statements, got %ld\n",
+            path, expected_statements, statements);
+    failed = 1;
+  }
+
+  if(!failed && min_mbps > 0.0 && mbps < min_mbps) {
+    fprintf(stderr,
+            "fsp_perf_check: FAILED: %s: %.2f MB/s below the %.2f floor\n",
+            path, mbps, min_mbps);
+    failed = 1;
+  }
+
+  return failed;
+}
@@ -0,0 +1,558 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * fsp_pool.c - Multi-stream parser pool for libfsp
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "fsp.h"
+/* Keep the general entry points when the embedding build sets the
+ * specialization defines (see the profile at the end of fsp_internal.h) */
+#define FSP_BUILDING_LIBFSP 1
+#include "fsp_internal.h"
+
+#ifdef HAVE_PTHREAD_H
+
+/* Streams are hashed into this many buckets for id lookup */
+#define FSP_POOL_HASH_SIZE 256
+
+/* Retired contexts kept per worker for reuse before falling back to
+ * fsp_destroy() */
+#define FSP_POOL_CTX_FREELIST_MAX 16
+
+/* One queued (stream-id, chunk) work item; the chunk bytes are copied
+ * at submit time since the caller's buffer may not outlive the parse */
+typedef struct fsp_pool_item_s fsp_pool_item;
+struct fsp_pool_item_s {
+  char *data;                      /* Owned copy of the chunk bytes */
+  size_t length;
+  int is_end;
+  fsp_pool_item *next;
+};
+
+/* Per-stream state.  A stream is either on exactly one worker's run
+ * queue, being processed by exactly one worker, or idle with no
+ * pending items - never two of these at once, which is what preserves
+ * per-stream chunk ordering across work stealing. */
+typedef struct fsp_pool_stream_s fsp_pool_stream;
+struct fsp_pool_stream_s {
+  unsigned long id;
+  fsp_context *ctx;
+  fsp_pool_item *items_head;       /* FIFO of pending chunks */
+  fsp_pool_item *items_tail;
+  int running;                     /* A worker is parsing this stream */
+  int queued;                      /* On some worker's run queue */
+  int ended;                       /* End chunk queued; stream is dying */
+  int home;                        /* Home worker index (id hash) */
+  fsp_pool_stream *hash_next;      /* Bucket chain link */
+  fsp_pool_stream *run_next;       /* Run queue link */
+};
+
+typedef struct fsp_pool_worker_s {
+  pthread_t thread;
+  fsp_pool *pool;
+  int index;
+  fsp_pool_stream *run_head;       /* Runnable streams, FIFO */
+  fsp_pool_stream *run_tail;
+  fsp_context *ctx_freelist;       /* Retired contexts for reuse */
+  size_t ctx_free_count;
+} fsp_pool_worker;
+
+struct fsp_pool_s {
+  pthread_mutex_t lock;            /* Guards streams and run queues */
+  pthread_cond_t work_cond;        /* A stream became runnable */
+  pthread_cond_t idle_cond;        /* pending_items drained to zero */
+  fsp_pool_worker *workers;
+  int n_workers;
+  fsp_pool_stream *hash[FSP_POOL_HASH_SIZE];
+  size_t pending_items;            /* Queued plus in-flight chunks */
+  int shutting_down;
+  fsp_pool_callback callback;
+  void *callback_user_data;
+};
+
+
+/* Pop the next runnable stream, preferring our own run queue and
+ * stealing from the other workers' queues when it is empty.  Stealing
+ * a whole stream (rather than single items) keeps per-stream chunk
+ * order intact.  Called with the pool lock held. */
+static fsp_pool_stream *
+fsp_pool_take_stream(fsp_pool *pool, int self)
+{
+  int i;
+
+  for(i = 0; i < pool->n_workers; i++) {
+    fsp_pool_worker *worker = &pool->workers[(self + i) % pool->n_workers];
+    fsp_pool_stream *stream = worker->run_head;
+
+    if(!stream)
+      continue;
+
+    worker->run_head = stream->run_next;
+    if(!worker->run_head)
+      worker->run_tail = NULL;
+    stream->run_next = NULL;
+
+    return stream;
+  }
+
+  return NULL;
+}
+
+
+/* Unlink a stream from the id hash table.  Called with the pool lock
+ * held. */
+static void
+fsp_pool_unhash_stream(fsp_pool *pool, fsp_pool_stream *stream)
+{
+  fsp_pool_stream **slot = &pool->hash[stream->id % FSP_POOL_HASH_SIZE];
+
+  while(*slot && *slot != stream)
+    slot = &(*slot)->hash_next;
+  if(*slot)
+    *slot = stream->hash_next;
+}
+
+
+/* Retire a finished stream: park its context on the worker's freelist
+ * (or destroy it) and free the stream.  Called with the pool lock
+ * held. */
+static void
+fsp_pool_retire_stream(fsp_pool *pool, fsp_pool_stream *stream, int self)
+{
+  fsp_pool_worker *worker = &pool->workers[self];
+
+  fsp_pool_unhash_stream(pool, stream);
+
+  /* Defensive: drain anything still queued behind the end chunk so
+   * retirement neither leaks items nor strands fsp_pool_flush() on
+   * pending_items (the ended flag makes such items unreachable from
+   * fsp_pool_submit(), but they must still be accounted for) */
+  while(stream->items_head) {
+    fsp_pool_item *item = stream->items_head;
+
+    stream->items_head = item->next;
+    if(item->data)
+      FSP_FREE(char*, item->data);
+    FSP_FREE(fsp_pool_item*, item);
+
+    pool->pending_items--;
+  }
+  if(!pool->pending_items)
+    pthread_cond_broadcast(&pool->idle_cond);
+
+  if(worker->ctx_free_count < FSP_POOL_CTX_FREELIST_MAX &&
+     fsp_reset(stream->ctx) == 0) {
+    stream->ctx->pool_next = worker->ctx_freelist;
+    worker->ctx_freelist = stream->ctx;
+    worker->ctx_free_count++;
+  } else
+    fsp_destroy(stream->ctx);
+
+  FSP_FREE(fsp_pool_stream*, stream);
+}
+
+
+static void *
+fsp_pool_worker_main(void *arg)
+{
+  fsp_pool_worker *worker = (fsp_pool_worker*)arg;
+  fsp_pool *pool = worker->pool;
+
+  pthread_mutex_lock(&pool->lock);
+
+  for(;;) {
+    fsp_pool_stream *stream = fsp_pool_take_stream(pool, worker->index);
+
+    if(!stream) {
+      if(pool->shutting_down)
+        break;
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+      continue;
+    }
+
+    stream->queued = 0;
+    stream->running = 1;
+
+    /* Drain this stream's pending chunks; the stream is marked running
+     * so no other worker can take it and reorder them */
+    while(stream->items_head) {
+      fsp_pool_item *item = stream->items_head;
+      fsp_status status;
+      int is_end = item->is_end;
+
+      stream->items_head = item->next;
+      if(!stream->items_head)
+        stream->items_tail = NULL;
+
+      pthread_mutex_unlock(&pool->lock);
+
+      status = fsp_parse_chunk(stream->ctx, item->data, item->length, is_end);
+      if(pool->callback)
+        pool->callback(stream->ctx, stream->id, status,
+                       pool->callback_user_data);
+
+      if(item->data)
+        FSP_FREE(char*, item->data);
+      FSP_FREE(fsp_pool_item*, item);
+
+      pthread_mutex_lock(&pool->lock);
+
+      pool->pending_items--;
+      if(!pool->pending_items)
+        pthread_cond_broadcast(&pool->idle_cond);
+
+      if(is_end) {
+        fsp_pool_retire_stream(pool, stream, worker->index);
+        stream = NULL;
+        break;
+      }
+    }
+
+    if(stream)
+      stream->running = 0;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+/**
+ * fsp_pool_create - Create a pool of worker threads parsing independent streams
+ *
+ * @n_workers: Number of worker threads to start (at least 1)
+ * @callback: Completion callback invoked on a worker thread after each
+ *   chunk is parsed, or NULL for none
+ * @user_data: Opaque pointer passed to @callback
+ *
+ * Each stream submitted with fsp_pool_submit() gets its own
+ * fsp_context.  Streams are hashed to a home worker and idle workers
+ * steal whole streams from busy ones, so chunks of one stream are
+ * always parsed in submission order while independent streams parse in
+ * parallel.  The callback may drive the host's lexer/push parser from
+ * the worker thread; callbacks for one stream never run concurrently.
+ * Do not combine with fsp_set_context_pool_size() - the pool keeps its
+ * own per-worker context freelists and the global pool is not
+ * thread-safe.
+ *
+ * Returns: the new pool, or NULL on failure (or without pthreads)
+ */
+fsp_pool *
+fsp_pool_create(int n_workers, fsp_pool_callback callback, void *user_data)
+{
+  fsp_pool *pool;
+  int i;
+
+  if(n_workers < 1)
+    return NULL;
+
+  pool = FSP_CALLOC(fsp_pool*, 1, sizeof(*pool));
+  if(!pool)
+    return NULL;
+
+  pool->n_workers = n_workers;
+  pool->callback = callback;
+  pool->callback_user_data = user_data;
+
+  pool->workers = FSP_CALLOC(fsp_pool_worker*, (size_t)n_workers,
+                             sizeof(*pool->workers));
+  if(!pool->workers) {
+    FSP_FREE(fsp_pool*, pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->idle_cond, NULL);
+
+  for(i = 0; i < n_workers; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if(pthread_create(&pool->workers[i].thread, NULL, fsp_pool_worker_main,
+                      &pool->workers[i])) {
+      pool->n_workers = i;
+      fsp_pool_destroy(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+
+/**
+ * fsp_pool_submit - Queue a chunk of one stream for parsing
+ *
+ * @pool: The pool to submit to
+ * @stream_id: Identifies the stream the chunk belongs to
+ * @chunk: The chunk bytes (copied; the caller's buffer may be reused)
+ * @length: The length of the chunk in bytes
+ * @is_end: Whether this is the stream's last chunk
+ *
+ * The first chunk of an unknown @stream_id creates the stream's
+ * context (recycled from the home worker's freelist when possible);
+ * @is_end retires it after parsing.  The id may be reused for a new
+ * stream immediately - once the end chunk is queued the old stream no
+ * longer accepts submissions, so a reused id gets a fresh context even
+ * while the old stream's tail is still being parsed.  Thread-safe.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_pool_submit(fsp_pool *pool, unsigned long stream_id, const char *chunk,
+                size_t length, int is_end)
+{
+  fsp_pool_stream *stream;
+  fsp_pool_item *item;
+
+  if(!pool || (!chunk && length > 0))
+    return -1;
+
+  item = FSP_CALLOC(fsp_pool_item*, 1, sizeof(*item));
+  if(!item)
+    return -1;
+
+  if(length > 0) {
+    item->data = FSP_MALLOC(char*, length);
+    if(!item->data) {
+      FSP_FREE(fsp_pool_item*, item);
+      return -1;
+    }
+    memcpy(item->data, chunk, length);
+  }
+  item->length = length;
+  item->is_end = is_end;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if(pool->shutting_down) {
+    pthread_mutex_unlock(&pool->lock);
+    if(item->data)
+      FSP_FREE(char*, item->data);
+    FSP_FREE(fsp_pool_item*, item);
+    return -1;
+  }
+
+  /* Find or create the stream.  A stream whose end chunk is already
+   * queued is dying and skipped here: reusing its id creates a fresh
+   * stream instead of racing the worker that will retire the old one
+   * (which would silently drop and leak the new chunks) */
+  stream = pool->hash[stream_id % FSP_POOL_HASH_SIZE];
+  while(stream && (stream->id != stream_id || stream->ended))
+    stream = stream->hash_next;
+
+  if(!stream) {
+    int home = (int)(stream_id % (unsigned long)pool->n_workers);
+    fsp_pool_worker *worker = &pool->workers[home];
+
+    stream = FSP_CALLOC(fsp_pool_stream*, 1, sizeof(*stream));
+    if(!stream)
+      goto failed;
+
+    if(worker->ctx_freelist) {
+      stream->ctx = worker->ctx_freelist;
+      worker->ctx_freelist = stream->ctx->pool_next;
+      worker->ctx_free_count--;
+      stream->ctx->pool_next = NULL;
+    } else
+      stream->ctx = fsp_create();
+
+    if(!stream->ctx) {
+      FSP_FREE(fsp_pool_stream*, stream);
+      goto failed;
+    }
+
+    stream->id = stream_id;
+    stream->home = home;
+    stream->hash_next = pool->hash[stream_id % FSP_POOL_HASH_SIZE];
+    pool->hash[stream_id % FSP_POOL_HASH_SIZE] = stream;
+  }
+
+  /* Enqueue the item in stream order; an end chunk seals the stream
+   * against further submissions under the same id */
+  if(stream->items_tail)
+    stream->items_tail->next = item;
+  else
+    stream->items_head = item;
+  stream->items_tail = item;
+  if(is_end)
+    stream->ended = 1;
+  pool->pending_items++;
+
+  /* Make the stream runnable on its home worker unless a worker
+   * already has it (queued or running) */
+  if(!stream->running && !stream->queued) {
+    fsp_pool_worker *worker = &pool->workers[stream->home];
+
+    if(worker->run_tail)
+      worker->run_tail->run_next = stream;
+    else
+      worker->run_head = stream;
+    worker->run_tail = stream;
+    stream->queued = 1;
+
+    pthread_cond_signal(&pool->work_cond);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+
+failed:
+  pthread_mutex_unlock(&pool->lock);
+  if(item->data)
+    FSP_FREE(char*, item->data);
+  FSP_FREE(fsp_pool_item*, item);
+  return -1;
+}
+
+
+/**
+ * fsp_pool_flush - Wait until all submitted chunks have been parsed
+ *
+ * @pool: The pool to wait on
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int
+fsp_pool_flush(fsp_pool *pool)
+{
+  if(!pool)
+    return -1;
+
+  pthread_mutex_lock(&pool->lock);
+  while(pool->pending_items)
+    pthread_cond_wait(&pool->idle_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+
+/**
+ * fsp_pool_destroy - Drain remaining work, stop the workers and free the pool
+ *
+ * @pool: The pool to destroy, or NULL
+ *
+ * Already-submitted chunks are parsed (with callbacks) before the
+ * worker threads exit; further submissions are refused.
+ */
+void
+fsp_pool_destroy(fsp_pool *pool)
+{
+  int i;
+
+  if(!pool)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutting_down = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i = 0; i < pool->n_workers; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+
+  /* Workers drained every runnable stream; free whatever is left
+   * (streams with no pending items) and the context freelists */
+  for(i = 0; i < FSP_POOL_HASH_SIZE; i++) {
+    while(pool->hash[i]) {
+      fsp_pool_stream *stream = pool->hash[i];
+
+      pool->hash[i] = stream->hash_next;
+      while(stream->items_head) {
+        fsp_pool_item *item = stream->items_head;
+
+        stream->items_head = item->next;
+        if(item->data)
+          FSP_FREE(char*, item->data);
+        FSP_FREE(fsp_pool_item*, item);
+      }
+      fsp_destroy(stream->ctx);
+      FSP_FREE(fsp_pool_stream*, stream);
+    }
+  }
+
+  for(i = 0; i < pool->n_workers; i++) {
+    while(pool->workers[i].ctx_freelist) {
+      fsp_context *ctx = pool->workers[i].ctx_freelist;
+
+      pool->workers[i].ctx_freelist = ctx->pool_next;
+      ctx->pool_next = NULL;
+      fsp_destroy(ctx);
+    }
+  }
+
+  pthread_cond_destroy(&pool->idle_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  FSP_FREE(fsp_pool_worker*, pool->workers);
+  FSP_FREE(fsp_pool*, pool);
+}
+
+#else /* !HAVE_PTHREAD_H */
+
+/* Without POSIX threads the pool API is stubbed out */
+
+fsp_pool *
+fsp_pool_create(int n_workers, fsp_pool_callback callback, void *user_data)
+{
+  (void)n_workers;
+  (void)callback;
+  (void)user_data;
+  return NULL;
+}
+
+int
+fsp_pool_submit(fsp_pool *pool, unsigned long stream_id, const char *chunk,
+                size_t length, int is_end)
+{
+  (void)pool;
+  (void)stream_id;
+  (void)chunk;
+  (void)length;
+  (void)is_end;
+  return -1;
+}
+
+int
+fsp_pool_flush(fsp_pool *pool)
+{
+  (void)pool;
+  return -1;
+}
+
+void
+fsp_pool_destroy(fsp_pool *pool)
+{
+  (void)pool;
+}
+
+#endif /* HAVE_PTHREAD_H */
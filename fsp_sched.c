@@ -0,0 +1,315 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * fsp_sched.c - Cooperative multi-stream scheduler for libfsp
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsp.h"
+/* Keep the general entry points when the embedding build sets the
+ * specialization defines (see the profile at the end of fsp_internal.h) */
+#define FSP_BUILDING_LIBFSP 1
+#include "fsp_internal.h"
+
+/* Single-threaded cooperative scheduler over many contexts
+ * (fsp_sched_create()): registered contexts sit on a doubly-linked
+ * membership list, and the subset with unread bytes sits on a FIFO
+ * ready queue threaded through the contexts themselves, so a run only
+ * ever touches streams with work - idle connections cost nothing.
+ * fsp_sched_run() gives each ready context one bounded
+ * fsp_drive_parser() turn per round; a stream whose budget runs out
+ * (FSP_STATUS_AGAIN) goes to the back of the queue instead of hogging
+ * the thread. */
+struct fsp_sched_s {
+  fsp_context *contexts;           /* Membership list head */
+  size_t context_count;            /* Registered contexts */
+  fsp_context *ready_head;         /* FIFO ready queue */
+  fsp_context *ready_tail;
+  size_t ready_count;              /* Contexts on the ready queue */
+};
+
+
+/* Put @ctx at the back of the ready queue (no-op if already queued) */
+static void
+fsp_sched_enqueue(fsp_sched *sched, fsp_context *ctx)
+{
+  if(ctx->sched_ready)
+    return;
+
+  ctx->sched_ready = 1;
+  ctx->sched_ready_next = NULL;
+  if(sched->ready_tail)
+    sched->ready_tail->sched_ready_next = ctx;
+  else
+    sched->ready_head = ctx;
+  sched->ready_tail = ctx;
+  sched->ready_count++;
+}
+
+
+/* Take @ctx off the ready queue wherever it sits */
+static void
+fsp_sched_unqueue(fsp_sched *sched, fsp_context *ctx)
+{
+  fsp_context *scan;
+  fsp_context *prev = NULL;
+
+  if(!ctx->sched_ready)
+    return;
+
+  for(scan = sched->ready_head; scan; prev = scan,
+        scan = scan->sched_ready_next) {
+    if(scan != ctx)
+      continue;
+
+    if(prev)
+      prev->sched_ready_next = ctx->sched_ready_next;
+    else
+      sched->ready_head = ctx->sched_ready_next;
+    if(sched->ready_tail == ctx)
+      sched->ready_tail = prev;
+    break;
+  }
+
+  ctx->sched_ready = 0;
+  ctx->sched_ready_next = NULL;
+  sched->ready_count--;
+}
+
+
+/**
+ * fsp_sched_create - Create a cooperative multi-stream scheduler
+ *
+ * Returns: New scheduler, or NULL on failure
+ */
+fsp_sched*
+fsp_sched_create(void)
+{
+  return FSP_CALLOC(fsp_sched*, 1, sizeof(fsp_sched));
+}
+
+
+/**
+ * fsp_sched_destroy - Destroy a scheduler
+ *
+ * @sched: Scheduler to destroy (may be NULL)
+ *
+ * Deregisters any remaining contexts; the contexts themselves are not
+ * destroyed - they belong to the host.
+ */
+void
+fsp_sched_destroy(fsp_sched *sched)
+{
+  fsp_context *ctx;
+  fsp_context *next;
+
+  if(!sched)
+    return;
+
+  for(ctx = sched->contexts; ctx; ctx = next) {
+    next = ctx->sched_registered_next;
+    ctx->sched = NULL;
+    ctx->sched_registered_next = NULL;
+    ctx->sched_registered_prev = NULL;
+    ctx->sched_ready_next = NULL;
+    ctx->sched_ready = 0;
+  }
+
+  FSP_FREE(fsp_sched*, sched);
+}
+
+
+/**
+ * fsp_sched_add - Register a context with a scheduler
+ *
+ * @sched: The scheduler
+ * @ctx: Context to register
+ *
+ * The context must have a parser driver registered
+ * (fsp_set_parser_driver()) before the scheduler first runs it, since
+ * the turns are taken through fsp_drive_parser().  A context already
+ * holding unread bytes starts out ready.  A context belongs to at
+ * most one scheduler, and must be removed (fsp_sched_remove()) before
+ * it is destroyed.
+ *
+ * Returns: 0 on success, -1 on failure or if already registered
+ */
+int
+fsp_sched_add(fsp_sched *sched, fsp_context *ctx)
+{
+  if(!sched || !ctx || ctx->sched)
+    return -1;
+
+  ctx->sched = sched;
+  ctx->sched_registered_prev = NULL;
+  ctx->sched_registered_next = sched->contexts;
+  if(sched->contexts)
+    sched->contexts->sched_registered_prev = ctx;
+  sched->contexts = ctx;
+  sched->context_count++;
+
+  if(fsp_buffer_available(ctx) > 0)
+    fsp_sched_enqueue(sched, ctx);
+
+  return 0;
+}
+
+
+/**
+ * fsp_sched_remove - Deregister a context from a scheduler
+ *
+ * @sched: The scheduler
+ * @ctx: Context to deregister
+ *
+ * Returns: 0 on success, -1 if @ctx is not registered with @sched
+ */
+int
+fsp_sched_remove(fsp_sched *sched, fsp_context *ctx)
+{
+  if(!sched || !ctx || ctx->sched != (void*)sched)
+    return -1;
+
+  fsp_sched_unqueue(sched, ctx);
+
+  if(ctx->sched_registered_prev)
+    ctx->sched_registered_prev->sched_registered_next =
+      ctx->sched_registered_next;
+  else
+    sched->contexts = ctx->sched_registered_next;
+  if(ctx->sched_registered_next)
+    ctx->sched_registered_next->sched_registered_prev =
+      ctx->sched_registered_prev;
+
+  ctx->sched = NULL;
+  ctx->sched_registered_next = NULL;
+  ctx->sched_registered_prev = NULL;
+  sched->context_count--;
+
+  return 0;
+}
+
+
+/**
+ * fsp_sched_feed - Feed a chunk to a registered context
+ *
+ * @sched: The scheduler
+ * @ctx: Context to feed
+ * @chunk: Chunk bytes
+ * @length: Chunk length in bytes
+ * @is_end: Whether this is the last input of the stream
+ *
+ * Buffers the chunk exactly like fsp_parse_chunk() (watermarks and
+ * input filters included) and marks the context ready so the next
+ * fsp_sched_run() gives it a turn.  No parsing happens here.
+ *
+ * Returns: FSP_STATUS_NEED_DATA or FSP_STATUS_OK when the chunk was
+ * accepted, FSP_STATUS_WOULD_BLOCK when the context is backpressured,
+ * or an error status
+ */
+fsp_status
+fsp_sched_feed(fsp_sched *sched, fsp_context *ctx, const char *chunk,
+               size_t length, int is_end)
+{
+  fsp_status status;
+
+  if(!sched || !ctx || ctx->sched != (void*)sched)
+    return FSP_STATUS_ERROR;
+
+  status = fsp_parse_chunk(ctx, chunk, length, is_end);
+  if(status == FSP_STATUS_WOULD_BLOCK || status == FSP_STATUS_ERROR ||
+     status == FSP_STATUS_NO_MEMORY)
+    return status;
+
+  if(fsp_buffer_available(ctx) > 0 || is_end)
+    fsp_sched_enqueue(sched, ctx);
+
+  return status;
+}
+
+
+/**
+ * fsp_sched_run - Run one fair round over the ready contexts
+ *
+ * @sched: The scheduler
+ * @budget: Maximum parser tokens per context for this round
+ *   (0 = unbounded: each context drains its buffered input)
+ *
+ * Round-robins the ready queue: every context that was ready on entry
+ * gets one fsp_drive_parser() turn of at most @budget tokens.  A
+ * context that exhausts its budget with input left
+ * (FSP_STATUS_AGAIN) re-queues at the back; one that runs dry
+ * (FSP_STATUS_NEED_DATA), completes or fails goes idle until the next
+ * fsp_sched_feed().  Contexts made ready during the round are not run
+ * until the next call, so one round is bounded work.
+ *
+ * Returns: Number of contexts still ready (call again while > 0), or
+ * -1 on failure
+ */
+int
+fsp_sched_run(fsp_sched *sched, int budget)
+{
+  size_t turns;
+
+  if(!sched)
+    return -1;
+
+  for(turns = sched->ready_count; turns > 0 && sched->ready_head;
+      turns--) {
+    fsp_context *ctx = sched->ready_head;
+    fsp_status status;
+
+    sched->ready_head = ctx->sched_ready_next;
+    if(!sched->ready_head)
+      sched->ready_tail = NULL;
+    ctx->sched_ready = 0;
+    ctx->sched_ready_next = NULL;
+    sched->ready_count--;
+
+    status = fsp_drive_parser(ctx, budget);
+    if(status == FSP_STATUS_AGAIN)
+      fsp_sched_enqueue(sched, ctx);
+    /* NEED_DATA, OK and errors all idle the stream; the host sees the
+     * outcome through its driver and parser state */
+  }
+
+  return (int)sched->ready_count;
+}
+
+
+/**
+ * fsp_sched_ready - Number of contexts with runnable work
+ *
+ * @sched: The scheduler
+ *
+ * Returns: Contexts on the ready queue, or 0 if @sched is NULL
+ */
+size_t
+fsp_sched_ready(fsp_sched *sched)
+{
+  if(!sched)
+    return 0;
+
+  return sched->ready_count;
+}
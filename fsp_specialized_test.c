@@ -0,0 +1,173 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * fsp_specialized_test.c - Test program for the compile-time
+ * specialization profile (see the end of fsp_internal.h)
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ */
+
+#ifdef HAVE_FSP_CONFIG_H
+#include <fsp_config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fsp.h"
+
+/* Full embedded profile: fixed buffer the size of the context's
+ * inline storage, no growth, no NULL guards.  fsp_read_input() and
+ * fsp_buffer_append() below this point are the inline fast paths. */
+#define FSP_FIXED_BUFFER_SIZE 4096
+#define FSP_ASSUME_VALID_CTX 1
+#include "fsp_internal.h"
+
+static int test_count = 0;
+static int test_failed = 0;
+
+#define TEST(name) do { \
+  test_count++; \
+  fprintf(stderr, "Test %d: %s ... ", test_count, name); \
+} while(0)
+
+#define PASS() do { \
+  fprintf(stderr, "PASS\n"); \
+} while(0)
+
+#define FAIL(msg) do { \
+  fprintf(stderr, "FAIL: %s\n", msg); \
+  test_failed++; \
+} while(0)
+
+int
+main(int argc, char *argv[])
+{
+  fsp_context *ctx;
+  char buffer[FSP_FIXED_BUFFER_SIZE];
+  char chunk[1024];
+  int bytes_read;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  fprintf(stderr, "libfsp specialized profile test suite\n");
+  fprintf(stderr, "=====================================\n\n");
+
+  ctx = fsp_create();
+  if(!ctx) {
+    fprintf(stderr, "Failed to create FSP context\n");
+    return 1;
+  }
+
+  /* Test 1: The fixed capacity matches the live context */
+  TEST("fixed capacity matches context");
+  if(ctx->buffer_capacity != (size_t)FSP_FIXED_BUFFER_SIZE)
+    FAIL("Context capacity differs from FSP_FIXED_BUFFER_SIZE");
+  else if(ctx->stream_buffer != ctx->inline_buffer)
+    FAIL("Fixed buffer is not the inline storage");
+  else
+    PASS();
+
+  /* Test 2: Append/read round trip through the inline paths */
+  TEST("inline append/read round trip");
+  if(fsp_buffer_append(ctx, "let x = 1;", 10) < 0) {
+    FAIL("Append failed");
+  } else {
+    bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+    if(bytes_read != 10 || memcmp(buffer, "let x = 1;", 10) != 0)
+      FAIL("Read back mismatch");
+    else
+      PASS();
+  }
+
+  /* Test 3: Reads are bounded by max_size and resume where they left off */
+  TEST("bounded reads resume correctly");
+  if(fsp_buffer_append(ctx, "abcdefgh", 8) < 0) {
+    FAIL("Append failed");
+  } else if(fsp_read_input(ctx, buffer, 3) != 3 ||
+            memcmp(buffer, "abc", 3) != 0) {
+    FAIL("First bounded read mismatch");
+  } else if(fsp_read_input(ctx, buffer, sizeof(buffer)) != 5 ||
+            memcmp(buffer, "defgh", 5) != 0) {
+    FAIL("Resumed read mismatch");
+  } else if(fsp_read_input(ctx, buffer, sizeof(buffer)) != 0) {
+    FAIL("Drained buffer should read zero bytes");
+  } else {
+    PASS();
+  }
+
+  /* Test 4: Steady-state streaming compacts in place of growing */
+  TEST("steady state compacts within fixed buffer");
+  memset(chunk, 'x', sizeof(chunk));
+  for(i = 0; i < 100; i++) {
+    if(fsp_buffer_append(ctx, chunk, sizeof(chunk)) < 0) {
+      FAIL("Append failed in steady state");
+      break;
+    }
+    bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+    if(bytes_read != (int)sizeof(chunk)) {
+      FAIL("Steady-state read size mismatch");
+      break;
+    }
+  }
+  if(i == 100) {
+    if(ctx->buffer_capacity != (size_t)FSP_FIXED_BUFFER_SIZE)
+      FAIL("Buffer grew despite FSP_NO_GROWTH");
+    else
+      PASS();
+  }
+
+  /* Test 5: An append that cannot fit fails instead of growing */
+  TEST("oversized append fails under FSP_NO_GROWTH");
+  if(fsp_buffer_append(ctx, chunk, sizeof(chunk)) < 0) {
+    FAIL("In-capacity append failed");
+  } else if(fsp_buffer_append(ctx, buffer, sizeof(buffer)) != -1) {
+    FAIL("Append past fixed capacity did not fail");
+  } else if(fsp_read_input(ctx, buffer, sizeof(buffer)) !=
+            (int)sizeof(chunk)) {
+    FAIL("Pending bytes lost by the failed append");
+  } else {
+    PASS();
+  }
+
+  /* Test 6: Compaction keeps the stream coordinate coherent */
+  TEST("stream_consumed tracks compacted bytes");
+  if(ctx->stream_consumed + ctx->read_position !=
+     (size_t)101 * sizeof(chunk) + 18)
+    FAIL("Absolute stream offset mismatch after compaction");
+  else
+    PASS();
+
+  fsp_destroy(ctx);
+
+  /* Summary */
+  fprintf(stderr, "\n==================\n");
+  fprintf(stderr, "Tests run: %d\n", test_count);
+  fprintf(stderr, "Tests passed: %d\n", test_count - test_failed);
+  fprintf(stderr, "Tests failed: %d\n", test_failed);
+
+  if(test_failed > 0) {
+    fprintf(stderr, "\nFAILED\n");
+    return 1;
+  }
+
+  fprintf(stderr, "\nAll tests passed\n");
+  return 0;
+}
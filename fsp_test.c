@@ -28,6 +28,15 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>  /* For compressing input to the gzip filter test */
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>   /* For the pipe in the fd-driven input test */
+#include <unistd.h>
+#endif
+
 #include "fsp.h"
 #include "fsp_internal.h"  /* For direct access to context internals in tests */
 #include "test_parser.h"
@@ -40,6 +49,138 @@
 static int test_count = 0;
 static int test_failed = 0;
 
+/* Counting allocator for the fsp_set_allocator() test */
+static int counting_mallocs = 0;
+static int counting_frees = 0;
+
+static void *counting_malloc(size_t size, void *user_data);
+static void *counting_calloc(size_t nmemb, size_t size, void *user_data);
+static void counting_free(void *ptr, void *user_data);
+
+static void *
+counting_malloc(size_t size, void *user_data)
+{
+  (void)user_data;
+  counting_mallocs++;
+  return malloc(size);
+}
+
+static void *
+counting_calloc(size_t nmemb, size_t size, void *user_data)
+{
+  (void)user_data;
+  counting_mallocs++;
+  return calloc(nmemb, size);
+}
+
+static void
+counting_free(void *ptr, void *user_data)
+{
+  (void)user_data;
+  if(ptr)
+    counting_frees++;
+  free(ptr);
+}
+
+/* Batched driver glue appended to test_parser.c by
+ * postprocess-bison.py --batch-driver */
+fsp_status test_parser_drive_fsp_parser(fsp_context *fsp_ctx, int max_tokens, void *user_data);
+
+/* Memory sink/source for the checkpoint/restore test */
+typedef struct checkpoint_sink_s {
+  char data[8192];
+  size_t length;
+  size_t position;
+} checkpoint_sink;
+
+static int checkpoint_write(void *user_data, const char *data, size_t length);
+static int checkpoint_read(void *user_data, char *buffer, size_t length);
+
+static int
+checkpoint_write(void *user_data, const char *data, size_t length)
+{
+  checkpoint_sink *sink = (checkpoint_sink*)user_data;
+
+  if(sink->length + length > sizeof(sink->data))
+    return -1;
+  memcpy(sink->data + sink->length, data, length);
+  sink->length += length;
+  return 0;
+}
+
+static int
+checkpoint_read(void *user_data, char *buffer, size_t length)
+{
+  checkpoint_sink *sink = (checkpoint_sink*)user_data;
+
+  if(sink->position + length > sink->length)
+    return -1;
+  memcpy(buffer, sink->data + sink->position, length);
+  sink->position += length;
+  return 0;
+}
+
+/* Per-stream tallies for the fsp_pool test.  Each stream's callbacks
+ * are serialized by the pool, so each slot is only ever touched by one
+ * worker at a time and no extra locking is needed. */
+#define POOL_TEST_STREAMS 64
+typedef struct pool_tally_s {
+  int chunks[POOL_TEST_STREAMS];
+  size_t bytes[POOL_TEST_STREAMS];
+} pool_tally;
+
+static void
+pool_test_callback(fsp_context *ctx, unsigned long stream_id,
+                   fsp_status status, void *user_data)
+{
+  pool_tally *tally = (pool_tally*)user_data;
+  char drain[256];
+  int n;
+
+  /* A bad status leaves the stream's chunk count short, which the
+   * final verification catches */
+  if(stream_id >= POOL_TEST_STREAMS ||
+     (status != FSP_STATUS_NEED_DATA && status != FSP_STATUS_OK))
+    return;
+
+  tally->chunks[stream_id]++;
+  while((n = fsp_read_input(ctx, drain, sizeof(drain))) > 0)
+    tally->bytes[stream_id] += (size_t)n;
+}
+
+/* Drain notification for the fsp_set_watermarks() test */
+static void
+count_drain(fsp_context *ctx, void *user_data)
+{
+  (void)ctx;
+  (*(int*)user_data)++;
+}
+
+#ifdef FSP_TRACE
+/* Per-event tallies for the hot-path tracing test */
+typedef struct trace_tally_s {
+  size_t counts[FSP_TRACE_PARSE_CHUNK + 1];
+  size_t bytes[FSP_TRACE_PARSE_CHUNK + 1];
+  unsigned long long last_sequence;
+  int sequence_gap;
+} trace_tally;
+
+static void
+trace_test_callback(const fsp_trace_record *record, void *user_data)
+{
+  trace_tally *tally = (trace_tally*)user_data;
+
+  if(record->event > FSP_TRACE_PARSE_CHUNK)
+    return;
+
+  tally->counts[record->event]++;
+  tally->bytes[record->event] += record->bytes;
+  if(tally->last_sequence && record->sequence != tally->last_sequence + 1)
+    tally->sequence_gap = 1;
+  tally->last_sequence = record->sequence;
+}
+#endif
+
 /* Helper function to read file into memory */
 static char*
 read_file(const char *filename, size_t *length)
@@ -661,6 +802,1756 @@ int main(int argc, char **argv)
     }
   }
 
+  /* Test 21: Borrowed (zero-copy) chunk mode */
+  TEST("fsp_parse_chunk_borrowed zero-copy read");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    chunk1 = "print ";
+    chunk2 = "\"hi\";";
+
+    if(fsp_parse_chunk_borrowed(ctx, chunk1, strlen(chunk1), 0) != FSP_STATUS_NEED_DATA ||
+       fsp_parse_chunk_borrowed(ctx, chunk2, strlen(chunk2), 1) != FSP_STATUS_OK) {
+      FAIL("Borrowed chunk status mismatch");
+    } else if(fsp_buffer_available(ctx) != strlen(chunk1) + strlen(chunk2)) {
+      FAIL("Borrowed chunk available mismatch");
+    } else if(ctx->data_length != 0) {
+      /* Nothing should have been copied into the stream buffer */
+      FAIL("Borrowed chunks were copied into stream buffer");
+    } else {
+      bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+      if(bytes_read != (int)(strlen(chunk1) + strlen(chunk2)) ||
+         memcmp(buffer, "print \"hi\";", (size_t)bytes_read) != 0) {
+        FAIL("Borrowed chunk read mismatch");
+      } else {
+        PASS();
+      }
+    }
+    fsp_destroy(ctx);
+  }
+
+  /* Test 22: Mixing borrowed and copied chunks preserves byte order */
+  TEST("fsp_parse_chunk_borrowed mixed with fsp_buffer_append");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    if(fsp_parse_chunk_borrowed(ctx, "abc", 3, 0) != FSP_STATUS_NEED_DATA ||
+       fsp_buffer_append(ctx, "def", 3) < 0) {
+      FAIL("Mixed append failed");
+    } else {
+      bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+      if(bytes_read != 6 || memcmp(buffer, "abcdef", 6) != 0) {
+        FAIL("Mixed chunk order mismatch");
+      } else {
+        PASS();
+      }
+    }
+    fsp_destroy(ctx);
+  }
+
+  /* Test 23: Ring buffer mode - wrap-around append/read cycles */
+  TEST("fsp_set_ring_buffer wrap-around streaming");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else if(fsp_set_ring_buffer(ctx, 1) < 0) {
+    FAIL("Failed to enable ring mode");
+    fsp_destroy(ctx);
+  } else {
+    /* Enough 10-byte append/read cycles to wrap the 64KB ring several
+     * times; each read must return the bytes just appended */
+    const char *pattern = "0123456789";
+    int cycle;
+    int ring_ok = 1;
+
+    for(cycle = 0; cycle < 20000; cycle++) {
+      if(fsp_buffer_append(ctx, pattern, 10) < 0 ||
+         fsp_read_input(ctx, buffer, 10) != 10 ||
+         memcmp(buffer, pattern, 10) != 0) {
+        ring_ok = 0;
+        break;
+      }
+    }
+
+    /* Switch back to linear mode with data still buffered */
+    if(ring_ok) {
+      if(fsp_buffer_append(ctx, pattern, 10) < 0 ||
+         fsp_set_ring_buffer(ctx, 0) < 0 ||
+         fsp_read_input(ctx, buffer, 10) != 10 ||
+         memcmp(buffer, pattern, 10) != 0)
+        ring_ok = 0;
+    }
+
+    if(!ring_ok) {
+      FAIL("Ring buffer data mismatch");
+    } else {
+      PASS();
+    }
+    fsp_destroy(ctx);
+  }
+
+  /* Test 24: Pluggable allocator routes all allocations */
+  TEST("fsp_set_allocator custom allocator");
+  {
+    fsp_allocator counting_allocator;
+
+    memset(&counting_allocator, 0, sizeof(counting_allocator));
+    counting_allocator.malloc_fn = counting_malloc;
+    counting_allocator.calloc_fn = counting_calloc;
+    counting_allocator.free_fn = counting_free;
+
+    fsp_set_allocator(&counting_allocator);
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context with custom allocator");
+      fsp_set_allocator(NULL);
+    } else {
+      fsp_destroy(ctx);
+      fsp_set_allocator(NULL);
+      /* Context struct only - the stream buffer starts in the
+       * context's inline storage, so no second allocation */
+      if(counting_mallocs < 1 || counting_mallocs != counting_frees) {
+        FAIL("Allocation counts mismatch");
+        fprintf(stderr, "  mallocs %d frees %d\n",
+                counting_mallocs, counting_frees);
+      } else {
+        PASS();
+      }
+    }
+  }
+
+  /* Test 25: Context pool recycles destroyed contexts */
+  TEST("fsp_set_context_pool_size recycling");
+  {
+    fsp_context *first;
+    fsp_context *second;
+
+    fsp_set_context_pool_size(4);
+    first = fsp_create();
+    if(!first) {
+      FAIL("Failed to create context");
+    } else {
+      fsp_buffer_append(first, test_data, test_data_len);
+      fsp_destroy(first);  /* parked on the pool, not freed */
+
+      second = fsp_create();
+      if(second != first) {
+        FAIL("Pool did not recycle the context");
+      } else if(fsp_buffer_available(second) != 0) {
+        FAIL("Recycled context was not cleared");
+      } else {
+        PASS();
+      }
+      fsp_destroy(second);
+    }
+    /* Drain the pool so later tests see a clean slate */
+    fsp_set_context_pool_size(0);
+  }
+
+  /* Test 26: fsp_reset keeps the grown buffer and rearms streaming state */
+  TEST("fsp_reset context reuse");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    char *grown_buffer;
+    size_t grown_capacity;
+    int reset_ok = 1;
+
+    /* Grow the buffer beyond the default size */
+    large_size = 128 * 1024;
+    large_data = (char*)malloc(large_size);
+    if(!large_data) {
+      FAIL("Failed to allocate test data");
+      fsp_destroy(ctx);
+    } else {
+      memset(large_data, 'Y', large_size);
+      if(fsp_buffer_append(ctx, large_data, large_size) < 0)
+        reset_ok = 0;
+
+      grown_buffer = ctx->stream_buffer;
+      grown_capacity = ctx->buffer_capacity;
+      ctx->more_chunks_expected = 0;
+
+      if(reset_ok && fsp_reset(ctx) != 0)
+        reset_ok = 0;
+
+      if(reset_ok &&
+         (fsp_buffer_available(ctx) != 0 ||
+          ctx->stream_buffer != grown_buffer ||
+          ctx->buffer_capacity != grown_capacity ||
+          !ctx->more_chunks_expected ||
+          ctx->initialization_done))
+        reset_ok = 0;
+
+      /* Context must be fully usable for the next document */
+      if(reset_ok &&
+         (fsp_buffer_append(ctx, test_data, test_data_len) < 0 ||
+          fsp_read_input(ctx, buffer, sizeof(buffer)) != (int)test_data_len ||
+          memcmp(buffer, test_data, test_data_len) != 0))
+        reset_ok = 0;
+
+      if(!reset_ok) {
+        FAIL("Reset state mismatch");
+      } else {
+        PASS();
+      }
+      free(large_data);
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 27: Direct-fill reserve/commit */
+  TEST("fsp_buffer_reserve/fsp_buffer_commit direct fill");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    char *fill_ptr = NULL;
+    size_t fill_avail = 0;
+
+    if(fsp_buffer_reserve(ctx, 64, &fill_ptr, &fill_avail) < 0 ||
+       !fill_ptr || fill_avail < 64) {
+      FAIL("Reserve failed");
+    } else {
+      /* Simulate a kernel read() landing straight in the buffer */
+      memcpy(fill_ptr, test_data, test_data_len);
+      if(fsp_buffer_commit(ctx, test_data_len) < 0 ||
+         fsp_parse_committed(ctx, 1) != FSP_STATUS_OK ||
+         fsp_buffer_available(ctx) != test_data_len) {
+        FAIL("Commit/parse_committed failed");
+      } else {
+        bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+        if(bytes_read != (int)test_data_len ||
+           memcmp(buffer, test_data, test_data_len) != 0) {
+          FAIL("Committed data mismatch");
+        } else {
+          PASS();
+        }
+      }
+    }
+    fsp_destroy(ctx);
+  }
+
+  /* Test 28: Vectored append */
+  TEST("fsp_buffer_append_iov scatter/gather input");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    fsp_iovec iov[3];
+
+    iov[0].iov_base = "print ";
+    iov[0].iov_len = 6;
+    iov[1].iov_base = "\"vec\"";
+    iov[1].iov_len = 5;
+    iov[2].iov_base = ";";
+    iov[2].iov_len = 1;
+
+    if(fsp_parse_chunk_iov(ctx, iov, 3, 1) != FSP_STATUS_OK ||
+       fsp_buffer_available(ctx) != 12) {
+      FAIL("Vectored append failed");
+    } else {
+      bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+      if(bytes_read != 12 || memcmp(buffer, "print \"vec\";", 12) != 0) {
+        FAIL("Vectored append data mismatch");
+      } else {
+        PASS();
+      }
+    }
+    fsp_destroy(ctx);
+  }
+
+  /* Test 29: Parse a file via mmap (or buffered fallback) */
+  TEST("fsp_parse_file zero-copy file input (tests/simple.txt)");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    char *file_content;
+    size_t file_length;
+
+    file_content = read_file("tests/simple.txt", &file_length);
+    if(!file_content) {
+      FAIL("Could not read test file");
+      fsp_destroy(ctx);
+    } else {
+      if(fsp_parse_file(ctx, "tests/simple.txt") != FSP_STATUS_OK ||
+         fsp_buffer_available(ctx) != file_length) {
+        FAIL("fsp_parse_file failed");
+      } else {
+        bytes_read = fsp_read_input(ctx, buffer, sizeof(buffer));
+        if(bytes_read != (int)file_length ||
+           memcmp(buffer, file_content, file_length) != 0) {
+          FAIL("File content mismatch");
+        } else {
+          PASS();
+        }
+      }
+      free(file_content);
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 30: Hot-path statistics */
+  TEST("fsp_get_stats counters");
+  ctx = fsp_create();
+  if(!ctx) {
+    FAIL("Failed to create context");
+  } else {
+    fsp_stats stats;
+
+    large_size = 100 * 1024;
+    large_data = (char*)malloc(large_size);
+    if(!large_data) {
+      FAIL("Failed to allocate test data");
+      fsp_destroy(ctx);
+    } else {
+      memset(large_data, 'S', large_size);
+
+      /* Append enough to force a growth realloc, drain it, then stall */
+      fsp_buffer_append(ctx, large_data, large_size);
+      while(fsp_read_input(ctx, buffer, sizeof(buffer)) > 0)
+        ;
+
+      fsp_get_stats(ctx, &stats);
+      if(stats.bytes_appended != large_size ||
+         stats.bytes_read != large_size ||
+         stats.buffer_grows < 1 ||
+         stats.peak_buffer_capacity < large_size ||
+         stats.peak_unread != large_size ||
+         stats.read_stalls < 1) {
+        FAIL("Statistics counters mismatch");
+        fprintf(stderr,
+                "  appended %zu read %zu grows %zu peak_cap %zu"
+                " peak_unread %zu stalls %zu\n",
+                stats.bytes_appended, stats.bytes_read, stats.buffer_grows,
+                stats.peak_buffer_capacity, stats.peak_unread,
+                stats.read_stalls);
+      } else {
+        PASS();
+      }
+      free(large_data);
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 31: Configurable buffer sizing and growth policy */
+  TEST("fsp_create_with_config sizing/growth/ceiling/shrink");
+  {
+    fsp_config config;
+    int config_ok = 1;
+
+    fsp_config_init(&config);
+    config.initial_buffer_size = 1024;
+    config.growth_increment = 1024;
+    config.max_buffer_size = 4096;
+    config.shrink_threshold = 2048;
+
+    ctx = fsp_create_with_config(&config);
+    if(!ctx) {
+      FAIL("Failed to create configured context");
+    } else {
+      if(ctx->buffer_capacity != 1024)
+        config_ok = 0;
+
+      /* Linear growth: 3KB fits under the 4KB ceiling */
+      large_data = (char*)malloc(8192);
+      if(!large_data) {
+        config_ok = 0;
+      } else {
+        memset(large_data, 'C', 8192);
+        if(fsp_buffer_append(ctx, large_data, 3000) < 0 ||
+           ctx->buffer_capacity > 4096)
+          config_ok = 0;
+
+        /* Ceiling: pushing past 4KB of unread data must fail */
+        if(config_ok && fsp_buffer_append(ctx, large_data, 2000) == 0)
+          config_ok = 0;
+
+        /* Shrink-on-compact once the backlog is drained */
+        if(config_ok) {
+          while(fsp_read_input(ctx, buffer, sizeof(buffer)) > 0)
+            ;
+          fsp_buffer_compact(ctx);
+          if(ctx->buffer_capacity != 2048)
+            config_ok = 0;
+        }
+        free(large_data);
+      }
+
+      if(!config_ok) {
+        FAIL("Configured buffer policy not honored");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 32: Backpressure watermarks and FSP_STATUS_WOULD_BLOCK */
+  TEST("fsp_set_watermarks refusal and drain callback");
+  {
+    int drains = 0;
+    int watermark_ok = 1;
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      fsp_set_watermarks(ctx, 100, 20, count_drain, &drains);
+
+      large_data = (char*)malloc(200);
+      if(!large_data) {
+        watermark_ok = 0;
+      } else {
+        memset(large_data, 'W', 200);
+
+        /* Fill to the high watermark, then the next chunk is refused */
+        if(fsp_parse_chunk(ctx, large_data, 100, 0) != FSP_STATUS_NEED_DATA)
+          watermark_ok = 0;
+        if(watermark_ok &&
+           fsp_parse_chunk(ctx, large_data, 10, 0) != FSP_STATUS_WOULD_BLOCK)
+          watermark_ok = 0;
+        if(watermark_ok && fsp_buffer_available(ctx) != 100)
+          watermark_ok = 0;
+
+        /* Draining to the low watermark fires the callback exactly once */
+        if(watermark_ok) {
+          if(fsp_read_input(ctx, buffer, 64) != 64 || drains != 0)
+            watermark_ok = 0;
+          if(watermark_ok &&
+             (fsp_read_input(ctx, buffer, 16) != 16 || drains != 1))
+            watermark_ok = 0;
+          if(watermark_ok &&
+             (fsp_read_input(ctx, buffer, 16) != 16 || drains != 1))
+            watermark_ok = 0;
+        }
+
+        /* Feeding is accepted again below the watermark */
+        if(watermark_ok &&
+           fsp_parse_chunk(ctx, large_data, 10, 1) != FSP_STATUS_OK)
+          watermark_ok = 0;
+
+        free(large_data);
+      }
+
+      if(!watermark_ok) {
+        FAIL("Watermark backpressure not honored");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 33: SPSC handoff mode ring semantics (single-threaded) */
+  TEST("fsp_set_spsc wrap, full detection and mode switch");
+  {
+    fsp_config config;
+    int spsc_ok = 1;
+    int i;
+
+    /* Small fixed capacity to exercise wrap and full quickly */
+    fsp_config_init(&config);
+    config.initial_buffer_size = 64;
+
+    ctx = fsp_create_with_config(&config);
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* Data buffered before the switch is preserved */
+      if(fsp_buffer_append(ctx, "pre", 3) != 0)
+        spsc_ok = 0;
+      if(spsc_ok && fsp_set_spsc(ctx, 1) != 0)
+        spsc_ok = 0;
+      if(spsc_ok && fsp_buffer_available(ctx) != 3)
+        spsc_ok = 0;
+      if(spsc_ok &&
+         (fsp_read_input(ctx, buffer, 3) != 3 ||
+          memcmp(buffer, "pre", 3) != 0))
+        spsc_ok = 0;
+
+      /* Many append/read cycles force the indices to wrap */
+      for(i = 0; spsc_ok && i < 1000; i++) {
+        if(fsp_buffer_append(ctx, "0123456789", 10) != 0 ||
+           fsp_read_input(ctx, buffer, 10) != 10 ||
+           memcmp(buffer, "0123456789", 10) != 0)
+          spsc_ok = 0;
+      }
+
+      /* Fixed capacity: one slot stays empty, so 63 fits and 64 fails */
+      if(spsc_ok) {
+        large_data = (char*)malloc(64);
+        if(!large_data) {
+          spsc_ok = 0;
+        } else {
+          memset(large_data, 'S', 64);
+          if(fsp_buffer_append(ctx, large_data, 64) == 0)
+            spsc_ok = 0;
+          if(spsc_ok && fsp_buffer_append(ctx, large_data, 63) != 0)
+            spsc_ok = 0;
+          if(spsc_ok && fsp_buffer_append(ctx, large_data, 1) == 0)
+            spsc_ok = 0;  /* Full ring must refuse */
+          free(large_data);
+        }
+      }
+
+      /* Switching back preserves the unread backlog */
+      if(spsc_ok && fsp_set_spsc(ctx, 0) != 0)
+        spsc_ok = 0;
+      if(spsc_ok &&
+         (fsp_buffer_available(ctx) != 63 ||
+          fsp_read_input(ctx, buffer, 63) != 63 || buffer[62] != 'S'))
+        spsc_ok = 0;
+
+      if(!spsc_ok) {
+        FAIL("SPSC mode semantics not honored");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 34: Multi-stream parser pool */
+  TEST("fsp_pool parallel streams with ordering per stream");
+  {
+    static pool_tally tally;
+    static const char pool_chunk[] = "let p = 7; ";
+    fsp_pool *pool;
+    int pool_ok = 1;
+    int stream;
+    int chunk;
+
+    memset(&tally, '\0', sizeof(tally));
+
+    pool = fsp_pool_create(4, pool_test_callback, &tally);
+    if(!pool) {
+      FAIL("Failed to create pool");
+    } else {
+      /* Interleave submissions across all streams, 8 data chunks each
+       * plus an empty end-of-stream marker */
+      for(chunk = 0; pool_ok && chunk < 8; chunk++) {
+        for(stream = 0; stream < POOL_TEST_STREAMS; stream++) {
+          if(fsp_pool_submit(pool, (unsigned long)stream, pool_chunk,
+                             strlen(pool_chunk), 0) != 0)
+            pool_ok = 0;
+        }
+      }
+      for(stream = 0; pool_ok && stream < POOL_TEST_STREAMS; stream++) {
+        if(fsp_pool_submit(pool, (unsigned long)stream, NULL, 0, 1) != 0)
+          pool_ok = 0;
+      }
+
+      if(pool_ok && fsp_pool_flush(pool) != 0)
+        pool_ok = 0;
+
+      /* Every stream must have seen all 9 chunks and all its bytes */
+      for(stream = 0; pool_ok && stream < POOL_TEST_STREAMS; stream++) {
+        if(tally.chunks[stream] != 9 ||
+           tally.bytes[stream] != 8 * strlen(pool_chunk))
+          pool_ok = 0;
+      }
+
+      fsp_pool_destroy(pool);
+
+      if(!pool_ok) {
+        FAIL("Pool did not parse all streams correctly");
+      } else {
+        PASS();
+      }
+    }
+  }
+
+  /* Test 35: SIMD delimiter scanning */
+  TEST("fsp_scan_delims/fsp_scan_input find delimiters");
+  {
+    int scan_ok = 1;
+    size_t at;
+
+    /* Raw range: delimiter inside, past the vector width, and absent */
+    large_data = (char*)malloc(1024);
+    if(!large_data) {
+      FAIL("Out of memory");
+    } else {
+      memset(large_data, 'a', 1024);
+
+      large_data[700] = '"';
+      if(fsp_scan_delims(large_data, 1024, '"', '\n') != 700)
+        scan_ok = 0;
+
+      large_data[300] = '\n';
+      if(scan_ok && fsp_scan_delims(large_data, 1024, '"', '\n') != 300)
+        scan_ok = 0;
+      if(scan_ok && fsp_scan_delims(large_data, 1024, '"', -1) != 700)
+        scan_ok = 0;
+      if(scan_ok && fsp_scan_delims(large_data, 300, '"', '\n') != 300)
+        scan_ok = 0;
+      if(scan_ok && fsp_scan_delims(large_data, 7, 'a', -1) != 0)
+        scan_ok = 0;
+
+      /* Context scan spans buffered bytes and borrowed references */
+      ctx = fsp_create();
+      if(!ctx) {
+        scan_ok = 0;
+      } else {
+        if(fsp_buffer_append(ctx, "abcdef", 6) != 0 ||
+           fsp_parse_chunk_borrowed(ctx, "ghi\"jk", 6, 0) !=
+             FSP_STATUS_NEED_DATA)
+          scan_ok = 0;
+        at = fsp_scan_input(ctx, '"', -1);
+        if(scan_ok && at != 9)
+          scan_ok = 0;
+        if(scan_ok && fsp_scan_input(ctx, 'z', -1) != 12)
+          scan_ok = 0;
+        fsp_destroy(ctx);
+      }
+
+      free(large_data);
+
+      if(!scan_ok) {
+        FAIL("Delimiter scan returned wrong offset");
+      } else {
+        PASS();
+      }
+    }
+  }
+
+  /* Test 36: Incremental newline index and position queries */
+  TEST("fsp_position_for_offset line/column from newline index");
+  {
+    int index_ok = 1;
+    size_t line = 0;
+    size_t column = 0;
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* Disabled index refuses queries */
+      if(fsp_position_for_offset(ctx, 0, &line, &column) != -1)
+        index_ok = 0;
+
+      if(fsp_enable_newline_index(ctx, 1) != 0)
+        index_ok = 0;
+
+      /* "ab\ncd\n\nef" - newlines at offsets 2, 5 and 6; split across
+       * append styles to cover every indexing entry point */
+      if(index_ok && fsp_buffer_append(ctx, "ab\ncd", 5) != 0)
+        index_ok = 0;
+      if(index_ok &&
+         fsp_parse_chunk_borrowed(ctx, "\n\nef", 4, 0) !=
+           FSP_STATUS_NEED_DATA)
+        index_ok = 0;
+
+      if(index_ok &&
+         (fsp_position_for_offset(ctx, 0, &line, &column) != 0 ||
+          line != 1 || column != 1))
+        index_ok = 0;
+      if(index_ok &&
+         (fsp_position_for_offset(ctx, 4, &line, &column) != 0 ||
+          line != 2 || column != 2))
+        index_ok = 0;
+      if(index_ok &&
+         (fsp_position_for_offset(ctx, 7, &line, &column) != 0 ||
+          line != 4 || column != 1))
+        index_ok = 0;
+
+      /* Past the indexed stream is refused */
+      if(index_ok && fsp_position_for_offset(ctx, 100, &line, &column) != -1)
+        index_ok = 0;
+
+      if(!index_ok) {
+        FAIL("Newline index positions wrong");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 37: In-place scan window for yy_scan_buffer() */
+  TEST("fsp_scan_window exposes sentinel-terminated window");
+  {
+    int window_ok = 1;
+    char *start = NULL;
+    size_t window_len = 0;
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      if(fsp_buffer_append(ctx, "let x = 1;", 10) != 0)
+        window_ok = 0;
+
+      /* Window covers the unread bytes with two NULs after them */
+      if(window_ok &&
+         (fsp_scan_window(ctx, &start, &window_len) != 0 ||
+          window_len != 10 ||
+          memcmp(start, "let x = 1;", 10) ||
+          start[10] != '\0' || start[11] != '\0'))
+        window_ok = 0;
+
+      /* Consuming advances the window; unconsumed tail is preserved
+       * across a later append */
+      if(window_ok && fsp_scan_window_consume(ctx, 6) != 0)
+        window_ok = 0;
+      if(window_ok && fsp_buffer_append(ctx, " y;", 3) != 0)
+        window_ok = 0;
+      if(window_ok &&
+         (fsp_scan_window(ctx, &start, &window_len) != 0 ||
+          window_len != 7 ||
+          memcmp(start, "= 1; y;", 7) ||
+          start[7] != '\0' || start[8] != '\0'))
+        window_ok = 0;
+
+      /* Over-consuming is refused */
+      if(window_ok && fsp_scan_window_consume(ctx, 100) != -1)
+        window_ok = 0;
+
+      /* Ring mode has no stable linear window */
+      if(window_ok && fsp_scan_window_consume(ctx, 7) != 0)
+        window_ok = 0;
+      if(window_ok && fsp_set_ring_buffer(ctx, 1) != 0)
+        window_ok = 0;
+      if(window_ok && fsp_scan_window(ctx, &start, &window_len) != -1)
+        window_ok = 0;
+
+      if(!window_ok) {
+        FAIL("Scan window wrong");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 38: Keep-bytes compaction contract */
+  TEST("fsp_set_keep_from preserves in-progress token bytes");
+  {
+    fsp_config keep_config;
+    int keep_ok = 1;
+    char scratch[64];
+    char token_src[8];
+    char *start = NULL;
+    size_t window_len = 0;
+
+    fsp_config_init(&keep_config);
+    keep_config.initial_buffer_size = 64;
+
+    ctx = fsp_create_with_config(&keep_config);
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* 40 bytes, 30 read; an unfinished token started at offset 25 */
+      if(fsp_buffer_append(ctx,
+                           "0123456789012345678901234567890123456789",
+                           40) != 0 ||
+         fsp_read_input(ctx, scratch, 30) != 30 ||
+         fsp_set_keep_from(ctx, 25) != 0)
+        keep_ok = 0;
+
+      /* Compaction preserves bytes 25..29 just before the unread
+       * window instead of discarding up to the read position */
+      fsp_buffer_compact(ctx);
+      if(keep_ok &&
+         (fsp_scan_window(ctx, &start, &window_len) != 0 ||
+          window_len != 10 ||
+          memcmp(start - 5, "567890123456789", 15)))
+        keep_ok = 0;
+
+      /* A mark behind the already-discarded region is refused, as is
+       * switching to ring mode while a mark is set */
+      if(keep_ok && fsp_set_keep_from(ctx, 10) != -1)
+        keep_ok = 0;
+      if(keep_ok && fsp_set_ring_buffer(ctx, 1) != -1)
+        keep_ok = 0;
+
+      /* Borrowed chunks are copied while a mark is set, so the
+       * caller's chunk may be reused immediately */
+      memcpy(token_src, "abcdef", 6);
+      if(keep_ok &&
+         fsp_parse_chunk_borrowed(ctx, token_src, 6, 0) !=
+           FSP_STATUS_NEED_DATA)
+        keep_ok = 0;
+      memset(token_src, 'x', 6);
+      if(keep_ok &&
+         (fsp_read_input(ctx, scratch, 16) != 16 ||
+          memcmp(scratch, "0123456789abcdef", 16)))
+        keep_ok = 0;
+
+      /* Clearing the mark restores normal compaction */
+      if(keep_ok && fsp_set_keep_from(ctx, (size_t)-1) != 0)
+        keep_ok = 0;
+      if(keep_ok && fsp_set_ring_buffer(ctx, 1) != 0)
+        keep_ok = 0;
+
+      if(!keep_ok) {
+        FAIL("Keep mark not honoured");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+
+  /* Test 39: Transparent decompression input filter */
+#ifdef HAVE_ZLIB_H
+  TEST("fsp_set_input_filter decompresses into the stream buffer");
+  {
+    static const char plain[] =
+      "let a = 1;\nprint a;\nlet b = \"\"\"streams arrive compressed\"\"\";\n";
+    unsigned char compressed[256];
+    uLongf compressed_length = sizeof(compressed);
+    char out[sizeof(plain)];
+    int filter_ok = 1;
+    size_t half;
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else if(compress(compressed, &compressed_length,
+                       (const Bytef*)plain, sizeof(plain) - 1) != Z_OK) {
+      FAIL("compress() failed");
+      fsp_destroy(ctx);
+    } else {
+      if(fsp_set_input_filter(ctx, FSP_FILTER_GZIP) != 0)
+        filter_ok = 0;
+
+      /* Feed the compressed stream split mid-way; the filter inflates
+       * straight into the stream buffer */
+      half = (size_t)compressed_length / 2;
+      if(filter_ok &&
+         fsp_parse_chunk(ctx, (const char*)compressed, half, 0) !=
+           FSP_STATUS_NEED_DATA)
+        filter_ok = 0;
+      if(filter_ok &&
+         fsp_parse_chunk(ctx, (const char*)compressed + half,
+                         (size_t)compressed_length - half, 1) !=
+           FSP_STATUS_OK)
+        filter_ok = 0;
+
+      if(filter_ok &&
+         (fsp_read_input(ctx, out, sizeof(out)) != (int)(sizeof(plain) - 1) ||
+          memcmp(out, plain, sizeof(plain) - 1)))
+        filter_ok = 0;
+
+      /* A truncated compressed stream fails at end of input */
+      if(filter_ok && fsp_reset(ctx) != 0)
+        filter_ok = 0;
+      if(filter_ok &&
+         fsp_parse_chunk(ctx, (const char*)compressed, half, 1) !=
+           FSP_STATUS_ERROR)
+        filter_ok = 0;
+
+      /* Deselecting the filter restores plain appends */
+      if(filter_ok && fsp_set_input_filter(ctx, FSP_FILTER_NONE) != 0)
+        filter_ok = 0;
+
+      if(!filter_ok) {
+        FAIL("gzip filter did not decompress correctly");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+#else
+  TEST("fsp_set_input_filter refuses unbuilt filters");
+  {
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      if(fsp_set_input_filter(ctx, FSP_FILTER_GZIP) != -1) {
+        FAIL("gzip filter accepted without zlib");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+#endif
+
+  /* Test 40: Spill-to-disk overflow for oversized backlog */
+#ifdef HAVE_SYS_MMAN_H
+  TEST("fsp_config spill_threshold bounds RAM and round-trips bytes");
+  {
+    fsp_config spill_config;
+    int spill_ok = 1;
+    char pattern[97];
+    char out[128];
+    size_t fed = 0;
+    size_t drained = 0;
+    size_t i;
+    int n;
+
+    fsp_config_init(&spill_config);
+    spill_config.initial_buffer_size = 1024;
+    spill_config.spill_threshold = 1024;
+
+    for(i = 0; i < sizeof(pattern); i++)
+      pattern[i] = (char)('A' + (i % 26));
+
+    ctx = fsp_create_with_config(&spill_config);
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* Feed 64KB - far past the threshold - without reading */
+      while(fed < 64 * 1024) {
+        if(fsp_buffer_append(ctx, pattern, sizeof(pattern)) != 0) {
+          spill_ok = 0;
+          break;
+        }
+        fed += sizeof(pattern);
+      }
+
+      /* The backlog overflowed to disk, not into the buffer */
+      if(spill_ok &&
+         (ctx->spill_length == 0 || ctx->buffer_capacity > 2048 ||
+          fsp_buffer_available(ctx) != fed))
+        spill_ok = 0;
+
+      /* Reserve/commit and keep marks cannot jump the spilled bytes */
+      if(spill_ok) {
+        char *rptr;
+        size_t ravail;
+
+        if(fsp_buffer_reserve(ctx, 16, &rptr, &ravail) != -1 ||
+           fsp_set_keep_from(ctx, fed - 1) != -1)
+          spill_ok = 0;
+      }
+
+      /* Everything reads back in order, transparently */
+      while(spill_ok && (n = fsp_read_input(ctx, out, sizeof(out))) > 0) {
+        for(i = 0; i < (size_t)n; i++) {
+          if(out[i] != pattern[(drained + i) % sizeof(pattern)]) {
+            spill_ok = 0;
+            break;
+          }
+        }
+        drained += (size_t)n;
+      }
+      if(spill_ok && drained != fed)
+        spill_ok = 0;
+
+      /* Fully drained: the file rewound and RAM appends resume */
+      if(spill_ok && (ctx->spill_length != 0 || ctx->spill_read != 0))
+        spill_ok = 0;
+      if(spill_ok &&
+         (fsp_buffer_append(ctx, "tail", 4) != 0 ||
+          ctx->spill_length != 0 ||
+          fsp_read_input(ctx, out, sizeof(out)) != 4 ||
+          memcmp(out, "tail", 4)))
+        spill_ok = 0;
+
+      if(!spill_ok) {
+        FAIL("Spill overflow did not round-trip");
+      } else {
+        PASS();
+      }
+      fsp_destroy(ctx);
+    }
+  }
+#endif
+
+  /* Test 41: Inline small-buffer storage defers the heap allocation */
+  TEST("inline buffer promotes to heap only on growth");
+  {
+    fsp_config inline_config;
+    int inline_ok = 1;
+    char big[FSP_INLINE_BUFFER_SIZE + 100];
+    char out[256];
+    size_t i;
+    int n;
+
+    for(i = 0; i < sizeof(big); i++)
+      big[i] = (char)('a' + (i % 23));
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* A fresh context parses from the embedded storage */
+      if(ctx->stream_buffer != ctx->inline_buffer ||
+         ctx->buffer_capacity != FSP_INLINE_BUFFER_SIZE)
+        inline_ok = 0;
+
+      /* Small appends stay inline and round-trip */
+      if(inline_ok &&
+         (fsp_buffer_append(ctx, "let x = 1;", 10) != 0 ||
+          ctx->stream_buffer != ctx->inline_buffer ||
+          fsp_read_input(ctx, out, sizeof(out)) != 10 ||
+          memcmp(out, "let x = 1;", 10)))
+        inline_ok = 0;
+
+      /* Outgrowing the inline storage promotes to the heap at the
+       * configured initial size, preserving the stored bytes */
+      if(inline_ok &&
+         (fsp_buffer_append(ctx, big, sizeof(big)) != 0 ||
+          ctx->stream_buffer == ctx->inline_buffer ||
+          ctx->buffer_capacity < 64 * 1024))
+        inline_ok = 0;
+      i = 0;
+      while(inline_ok && (n = fsp_read_input(ctx, out, sizeof(out))) > 0) {
+        if(memcmp(out, big + i, (size_t)n)) {
+          inline_ok = 0;
+          break;
+        }
+        i += (size_t)n;
+      }
+      if(inline_ok && i != sizeof(big))
+        inline_ok = 0;
+
+      fsp_destroy(ctx);
+
+      /* A configured size below the inline size caps the capacity but
+       * still grows within the inline storage first */
+      if(inline_ok) {
+        fsp_config_init(&inline_config);
+        inline_config.initial_buffer_size = 64;
+        ctx = fsp_create_with_config(&inline_config);
+        if(!ctx ||
+           ctx->buffer_capacity != 64 ||
+           ctx->stream_buffer != ctx->inline_buffer ||
+           fsp_buffer_append(ctx, big, 100) != 0 ||
+           ctx->stream_buffer != ctx->inline_buffer ||
+           ctx->buffer_capacity < 100)
+          inline_ok = 0;
+        if(ctx)
+          fsp_destroy(ctx);
+      }
+
+      /* Combined with context pooling, a small-document parse cycle
+       * performs no allocations at all */
+      if(inline_ok) {
+        fsp_allocator counting_allocator;
+
+        memset(&counting_allocator, 0, sizeof(counting_allocator));
+        counting_allocator.malloc_fn = counting_malloc;
+        counting_allocator.calloc_fn = counting_calloc;
+        counting_allocator.free_fn = counting_free;
+
+        fsp_set_context_pool_size(1);
+        ctx = fsp_create();  /* warm the pool */
+        fsp_destroy(ctx);
+
+        fsp_set_allocator(&counting_allocator);
+        counting_mallocs = 0;
+        counting_frees = 0;
+
+        ctx = fsp_create();
+        if(!ctx ||
+           fsp_buffer_append(ctx, "print \"hi\";", 11) != 0 ||
+           fsp_read_input(ctx, out, sizeof(out)) != 11)
+          inline_ok = 0;
+        if(ctx)
+          fsp_destroy(ctx);
+        if(counting_mallocs != 0)
+          inline_ok = 0;
+
+        fsp_set_allocator(NULL);
+        fsp_set_context_pool_size(0);
+      }
+
+      if(!inline_ok) {
+        FAIL("Inline buffer storage misbehaved");
+      } else {
+        PASS();
+      }
+    }
+  }
+
+  /* Test 42: Checkpoint/restore round-trips the streaming state */
+  TEST("fsp_checkpoint and fsp_restore resume mid-stream");
+  {
+    checkpoint_sink sink;
+    fsp_context *restored;
+    int cp_ok = 1;
+    char out[128];
+
+    memset(&sink, 0, sizeof(sink));
+
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* A half-consumed backlog with end-of-input not yet seen */
+      fsp_buffer_append(ctx, "let x = 1; print x;", 19);
+      if(fsp_read_input(ctx, out, 10) != 10)
+        cp_ok = 0;
+
+      if(cp_ok && fsp_checkpoint(ctx, checkpoint_write, &sink) != 0)
+        cp_ok = 0;
+
+      /* The host appends its own blob to the same sink */
+      if(cp_ok && checkpoint_write(&sink, "HOSTBLOB", 8) != 0)
+        cp_ok = 0;
+
+      fsp_destroy(ctx);
+      ctx = NULL;
+
+      restored = cp_ok ? fsp_restore(checkpoint_read, &sink) : NULL;
+      if(cp_ok && !restored)
+        cp_ok = 0;
+
+      /* The unread tail and stream offsets carry over */
+      if(cp_ok &&
+         (fsp_buffer_available(restored) != 9 ||
+          fsp_read_input(restored, out, sizeof(out)) != 9 ||
+          memcmp(out, " print x;", 9)))
+        cp_ok = 0;
+
+      /* ...and the host blob follows the fsp payload */
+      if(cp_ok &&
+         (checkpoint_read(&sink, out, 8) != 0 ||
+          memcmp(out, "HOSTBLOB", 8)))
+        cp_ok = 0;
+
+      /* Feeding resumes where the stream left off */
+      if(cp_ok &&
+         (fsp_parse_chunk(restored, " done", 5, 1) != FSP_STATUS_OK ||
+          fsp_read_input(restored, out, sizeof(out)) != 5 ||
+          memcmp(out, " done", 5)))
+        cp_ok = 0;
+
+      if(restored)
+        fsp_destroy(restored);
+
+      /* A corrupted header is refused */
+      if(cp_ok) {
+        sink.position = 0;
+        sink.data[0] = 'X';
+        if(fsp_restore(checkpoint_read, &sink) != NULL)
+          cp_ok = 0;
+      }
+
+      if(!cp_ok) {
+        FAIL("Checkpoint/restore did not round-trip");
+      } else {
+        PASS();
+      }
+    }
+  }
+
+  /* Test 43: fd-driven input reads straight into the stream buffer */
+#ifdef HAVE_SYS_MMAN_H
+  TEST("fsp_attach_fd and fsp_on_readable drive the parse");
+  {
+    int fds[2];
+    int io_ok = 1;
+    char out[128];
+
+    if(pipe(fds) != 0) {
+      FAIL("Failed to create pipe");
+    } else {
+      fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+      ctx = fsp_create();
+      if(!ctx) {
+        FAIL("Failed to create context");
+        close(fds[0]);
+        close(fds[1]);
+      } else {
+        if(fsp_attach_fd(ctx, fds[0]) != 0)
+          io_ok = 0;
+
+        /* Data pending: drained into the buffer, more expected */
+        if(io_ok &&
+           (write(fds[1], "print \"a\";", 10) != 10 ||
+            fsp_on_readable(ctx) != FSP_STATUS_NEED_DATA ||
+            fsp_buffer_available(ctx) != 10))
+          io_ok = 0;
+
+        /* An empty wakeup (spurious readable) is harmless */
+        if(io_ok && fsp_on_readable(ctx) != FSP_STATUS_NEED_DATA)
+          io_ok = 0;
+
+        /* The bytes read back from the buffer as usual */
+        if(io_ok &&
+           (fsp_read_input(ctx, out, sizeof(out)) != 10 ||
+            memcmp(out, "print \"a\";", 10)))
+          io_ok = 0;
+
+        /* Closing the write end maps EOF onto end-of-stream */
+        if(io_ok &&
+           (write(fds[1], "let b=1;", 8) != 8 ||
+            (close(fds[1]), fds[1] = -1,
+             fsp_on_readable(ctx) != FSP_STATUS_OK) ||
+            fsp_read_input(ctx, out, sizeof(out)) != 8 ||
+            memcmp(out, "let b=1;", 8)))
+          io_ok = 0;
+
+        fsp_attach_fd(ctx, -1);
+        fsp_destroy(ctx);
+        close(fds[0]);
+        if(fds[1] >= 0)
+          close(fds[1]);
+
+        if(!io_ok) {
+          FAIL("fd-driven input misbehaved");
+        } else {
+          PASS();
+        }
+      }
+    }
+  }
+#endif
+
+  /* Test 44: Batched push-parse driver */
+  TEST("fsp_drive_parser batches the lex/push loop");
+  {
+    yyscan_t scanner;
+    test_parser_pstate *pstate;
+    int drv_ok = 1;
+    fsp_status st;
+    statement_node *stmt;
+    int count = 0;
+
+    test_parser_reset();
+    ctx = fsp_create();
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else if(test_lexer_lex_init(&scanner)) {
+      FAIL("Failed to init lexer");
+      fsp_destroy(ctx);
+    } else {
+      test_lexer_set_extra(ctx, scanner);
+      pstate = test_parser_pstate_new();
+      if(!pstate) {
+        FAIL("Failed to create parser state");
+        test_lexer_lex_destroy(scanner);
+        fsp_destroy(ctx);
+      } else {
+        /* No driver registered yet */
+        if(fsp_drive_parser(ctx, 0) != FSP_STATUS_ERROR)
+          drv_ok = 0;
+
+        fsp_set_parser_state(ctx, pstate);
+        fsp_set_lexer_scanner(ctx, scanner);
+        fsp_set_parser_driver(ctx, test_parser_drive_fsp_parser, NULL);
+
+        /* Mid-stream: the driver batches until the buffer runs dry */
+        fsp_parse_chunk(ctx, "let a = 1; print a; ", 20, 0);
+        st = fsp_drive_parser(ctx, 0);
+        if(st != FSP_STATUS_NEED_DATA)
+          drv_ok = 0;
+
+        /* A token budget stops the loop early with more pending */
+        fsp_parse_chunk(ctx, "let b = 2; let c = 3; ", 22, 0);
+        st = fsp_drive_parser(ctx, 2);
+        if(st != FSP_STATUS_AGAIN)
+          drv_ok = 0;
+
+        /* End of input: the driver pushes EOF and finishes */
+        fsp_parse_chunk(ctx, "print c;", 8, 1);
+        st = fsp_drive_parser(ctx, 0);
+        if(st != FSP_STATUS_OK)
+          drv_ok = 0;
+
+        for(stmt = test_parser_get_statements(); stmt; stmt = stmt->next)
+          count++;
+        if(count != 5)
+          drv_ok = 0;
+
+        test_parser_free_statements();
+        test_parser_pstate_delete(pstate);
+        test_lexer_lex_destroy(scanner);
+        fsp_destroy(ctx);
+
+        if(!drv_ok) {
+          FAIL("Batched driver misbehaved");
+        } else {
+          PASS();
+        }
+      }
+    }
+  }
+
+  /* Test 45: Adaptive pre-sizing learns from observed backlogs */
+  TEST("FSP_SIZE_ADAPTIVE pre-sizes from the backlog histogram");
+  {
+    fsp_config adaptive_config;
+    int adapt_ok = 1;
+    char block[5000];
+    fsp_stats adapt_stats;
+    int i;
+
+    memset(block, 'k', sizeof(block));
+    fsp_adaptive_reset();
+
+    if(fsp_adaptive_size() != 0)
+      adapt_ok = 0;
+
+    /* A workload with a regular ~5000-byte working set */
+    for(i = 0; adapt_ok && i < 10; i++) {
+      ctx = fsp_create();
+      if(!ctx ||
+         fsp_buffer_append(ctx, block, sizeof(block)) != 0)
+        adapt_ok = 0;
+      if(ctx)
+        fsp_destroy(ctx);
+    }
+    ctx = NULL;
+
+    /* The learned size is the enclosing power-of-two bucket */
+    if(adapt_ok && fsp_adaptive_size() != 8192)
+      adapt_ok = 0;
+
+    /* An adaptive context starts right-sized: one growth straight to
+     * the learned capacity instead of the realloc ladder */
+    if(adapt_ok) {
+      fsp_config_init(&adaptive_config);
+      adaptive_config.initial_buffer_size = FSP_SIZE_ADAPTIVE;
+      ctx = fsp_create_with_config(&adaptive_config);
+      if(!ctx ||
+         ctx->config.initial_buffer_size != 8192 ||
+         fsp_buffer_append(ctx, block, sizeof(block)) != 0)
+        adapt_ok = 0;
+      if(adapt_ok) {
+        fsp_get_stats(ctx, &adapt_stats);
+        if(adapt_stats.buffer_grows != 1 ||
+           ctx->buffer_capacity != 8192)
+          adapt_ok = 0;
+      }
+      if(ctx) {
+        fsp_destroy(ctx);
+        ctx = NULL;
+      }
+    }
+
+    /* With no history the policy falls back to the default */
+    if(adapt_ok) {
+      fsp_adaptive_reset();
+      fsp_config_init(&adaptive_config);
+      adaptive_config.initial_buffer_size = FSP_SIZE_ADAPTIVE;
+      ctx = fsp_create_with_config(&adaptive_config);
+      if(!ctx || ctx->config.initial_buffer_size != 64 * 1024)
+        adapt_ok = 0;
+      if(ctx) {
+        fsp_destroy(ctx);
+        ctx = NULL;
+      }
+    }
+    fsp_adaptive_reset();
+
+    if(!adapt_ok) {
+      FAIL("Adaptive pre-sizing misbehaved");
+    } else {
+      PASS();
+    }
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  /* Test 46: mmap-backed allocator for large stream buffers */
+  TEST("fsp_use_mmap_allocator large buffers");
+  {
+    int mmap_alloc_ok = 1;
+    char *big_chunk = (char*)malloc(256 * 1024);
+    int i;
+
+    if(!big_chunk || fsp_use_mmap_allocator(64 * 1024) != 0) {
+      mmap_alloc_ok = 0;
+    } else {
+      for(i = 0; i < 256 * 1024; i++)
+        big_chunk[i] = (char)('a' + (i % 26));
+
+      ctx = fsp_create();
+      if(!ctx ||
+         fsp_buffer_append(ctx, big_chunk, 256 * 1024) != 0)
+        mmap_alloc_ok = 0;
+
+      /* The grown buffer is past the threshold: mmap-backed and so
+       * 64-byte aligned */
+      if(mmap_alloc_ok &&
+         ((size_t)(void*)ctx->stream_buffer % 64) != 0)
+        mmap_alloc_ok = 0;
+
+      /* Growth goes through the allocator's mremap path */
+      if(mmap_alloc_ok) {
+        for(i = 0; mmap_alloc_ok && i < 8; i++) {
+          if(fsp_buffer_append(ctx, big_chunk, 256 * 1024) != 0)
+            mmap_alloc_ok = 0;
+        }
+      }
+
+      /* The bytes survived the remaps intact */
+      if(mmap_alloc_ok) {
+        bytes_read = fsp_read_input(ctx, buffer, 26);
+        if(bytes_read != 26 ||
+           memcmp(buffer, "abcdefghijklmnopqrstuvwxyz", 26) != 0)
+          mmap_alloc_ok = 0;
+      }
+
+      if(ctx) {
+        fsp_destroy(ctx);
+        ctx = NULL;
+      }
+      fsp_set_allocator(NULL);
+    }
+    free(big_chunk);
+
+    if(!mmap_alloc_ok) {
+      FAIL("mmap-backed allocator misbehaved");
+    } else {
+      PASS();
+    }
+  }
+#endif /* HAVE_SYS_MMAN_H */
+
+  /* Test 47: Cooperative multi-stream scheduler */
+  TEST("fsp_sched interleaves contexts under a token budget");
+  {
+    fsp_sched *sched;
+    fsp_context *ctx_a = NULL;
+    fsp_context *ctx_b = NULL;
+    yyscan_t scanner_a = NULL;
+    yyscan_t scanner_b = NULL;
+    test_parser_pstate *pstate_a = NULL;
+    test_parser_pstate *pstate_b = NULL;
+    statement_node *stmt;
+    int sched_ok = 1;
+    int count = 0;
+    int rounds;
+
+    test_parser_reset();
+    sched = fsp_sched_create();
+    ctx_a = fsp_create();
+    ctx_b = fsp_create();
+    if(!sched || !ctx_a || !ctx_b ||
+       test_lexer_lex_init(&scanner_a) ||
+       test_lexer_lex_init(&scanner_b)) {
+      sched_ok = 0;
+    } else {
+      test_lexer_set_extra(ctx_a, scanner_a);
+      test_lexer_set_extra(ctx_b, scanner_b);
+      pstate_a = test_parser_pstate_new();
+      pstate_b = test_parser_pstate_new();
+      if(!pstate_a || !pstate_b)
+        sched_ok = 0;
+    }
+
+    if(sched_ok) {
+      fsp_set_parser_state(ctx_a, pstate_a);
+      fsp_set_lexer_scanner(ctx_a, scanner_a);
+      fsp_set_parser_driver(ctx_a, test_parser_drive_fsp_parser, NULL);
+      fsp_set_parser_state(ctx_b, pstate_b);
+      fsp_set_lexer_scanner(ctx_b, scanner_b);
+      fsp_set_parser_driver(ctx_b, test_parser_drive_fsp_parser, NULL);
+
+      if(fsp_sched_add(sched, ctx_a) != 0 ||
+         fsp_sched_add(sched, ctx_b) != 0)
+        sched_ok = 0;
+      /* Double registration is refused */
+      if(sched_ok && fsp_sched_add(sched, ctx_a) == 0)
+        sched_ok = 0;
+      /* Nothing buffered yet: the ready queue is empty */
+      if(sched_ok && fsp_sched_ready(sched) != 0)
+        sched_ok = 0;
+    }
+
+    if(sched_ok) {
+      /* A hot stream and a light one */
+      fsp_status st;
+
+      st = fsp_sched_feed(sched, ctx_a,
+                          "let a = 1; let b = 2; let c = 3; "
+                          "let d = 4; let e = 5; ", 55, 0);
+      if(st != FSP_STATUS_NEED_DATA)
+        sched_ok = 0;
+      st = fsp_sched_feed(sched, ctx_b, "print x; ", 9, 0);
+      if(st != FSP_STATUS_NEED_DATA)
+        sched_ok = 0;
+      if(fsp_sched_ready(sched) != 2)
+        sched_ok = 0;
+    }
+
+    if(sched_ok) {
+      /* With a 4-token budget the light stream finishes its bytes in
+       * one turn while the hot one keeps re-queuing - but the hot
+       * stream never blocks the round from completing */
+      rounds = 0;
+      while(fsp_sched_run(sched, 4) > 0 && rounds < 100)
+        rounds++;
+      if(rounds == 0 || rounds >= 100)
+        sched_ok = 0;
+      /* Everything buffered was consumed; both streams idle */
+      if(fsp_sched_ready(sched) != 0 ||
+         fsp_buffer_available(ctx_a) != 0 ||
+         fsp_buffer_available(ctx_b) != 0)
+        sched_ok = 0;
+    }
+
+    if(sched_ok) {
+      /* Final chunks finish both parses */
+      if(fsp_sched_feed(sched, ctx_a, "print a;", 8, 1) !=
+         FSP_STATUS_OK ||
+         fsp_sched_feed(sched, ctx_b, "print y;", 8, 1) !=
+         FSP_STATUS_OK)
+        sched_ok = 0;
+      rounds = 0;
+      while(sched_ok && fsp_sched_run(sched, 4) > 0 && rounds < 100)
+        rounds++;
+
+      for(stmt = test_parser_get_statements(); stmt; stmt = stmt->next)
+        count++;
+      if(count != 8)
+        sched_ok = 0;
+    }
+
+    if(sched_ok) {
+      /* Deregistration */
+      if(fsp_sched_remove(sched, ctx_a) != 0 ||
+         fsp_sched_remove(sched, ctx_a) == 0 ||
+         fsp_sched_remove(sched, ctx_b) != 0)
+        sched_ok = 0;
+    }
+
+    test_parser_free_statements();
+    if(pstate_a)
+      test_parser_pstate_delete(pstate_a);
+    if(pstate_b)
+      test_parser_pstate_delete(pstate_b);
+    if(scanner_a)
+      test_lexer_lex_destroy(scanner_a);
+    if(scanner_b)
+      test_lexer_lex_destroy(scanner_b);
+    if(ctx_a)
+      fsp_destroy(ctx_a);
+    if(ctx_b)
+      fsp_destroy(ctx_b);
+    fsp_sched_destroy(sched);
+
+    if(!sched_ok) {
+      FAIL("Scheduler misbehaved");
+    } else {
+      PASS();
+    }
+  }
+
+  /* Test 48: Hot-path tracing (only live when built with -DFSP_TRACE=1) */
+#ifdef FSP_TRACE
+  TEST("fsp_trace_enable records append/read/parse events");
+  {
+    fsp_context *ctx = fsp_create();
+    trace_tally tally;
+    char readbuf[64];
+    size_t drained;
+    int trace_ok = 1;
+    int i;
+
+    memset(&tally, 0, sizeof(tally));
+
+    if(!ctx || fsp_trace_enable(ctx, 16) != 0)
+      trace_ok = 0;
+
+    if(trace_ok) {
+      /* One append + parse event, one 11-byte read, one read stall */
+      if(fsp_parse_chunk(ctx, "hello world", 11, 0) != FSP_STATUS_NEED_DATA)
+        trace_ok = 0;
+      if(fsp_read_input(ctx, readbuf, sizeof(readbuf)) != 11)
+        trace_ok = 0;
+      if(fsp_read_input(ctx, readbuf, sizeof(readbuf)) != 0)
+        trace_ok = 0;
+
+      drained = fsp_trace_drain(ctx, trace_test_callback, &tally);
+      if(drained != 4 ||
+         tally.counts[FSP_TRACE_APPEND] != 1 ||
+         tally.counts[FSP_TRACE_PARSE_CHUNK] != 1 ||
+         tally.counts[FSP_TRACE_READ] != 2 ||
+         tally.bytes[FSP_TRACE_APPEND] != 11 ||
+         tally.bytes[FSP_TRACE_READ] != 11 ||
+         tally.sequence_gap)
+        trace_ok = 0;
+
+      /* Ring already drained: nothing left */
+      if(fsp_trace_drain(ctx, trace_test_callback, &tally) != 0)
+        trace_ok = 0;
+    }
+
+    if(trace_ok) {
+      /* Overflow a tiny ring: newest records drop, and the sequence
+       * numbers make the gap visible after the next drain */
+      if(fsp_trace_enable(ctx, 2) != 0)
+        trace_ok = 0;
+      memset(&tally, 0, sizeof(tally));
+      for(i = 0; trace_ok && i < 4; i++) {
+        if(fsp_buffer_append(ctx, "x", 1) != 0)
+          trace_ok = 0;
+      }
+      if(trace_ok) {
+        if(fsp_trace_drain(ctx, trace_test_callback, &tally) != 2)
+          trace_ok = 0;
+        /* The two dropped events leave a gap before the next record */
+        if(fsp_buffer_append(ctx, "y", 1) != 0 ||
+           fsp_trace_drain(ctx, trace_test_callback, &tally) != 1 ||
+           !tally.sequence_gap)
+          trace_ok = 0;
+      }
+    }
+
+    if(trace_ok) {
+      /* Capacity 0 releases the ring and disables tracing */
+      if(fsp_trace_enable(ctx, 0) != 0 ||
+         fsp_buffer_append(ctx, "z", 1) != 0 ||
+         fsp_trace_drain(ctx, trace_test_callback, &tally) != 0)
+        trace_ok = 0;
+    }
+
+    if(fsp_trace_enable(NULL, 16) != -1)
+      trace_ok = 0;
+
+    if(ctx)
+      fsp_destroy(ctx);
+
+    if(!trace_ok) {
+      FAIL("Trace ring misbehaved");
+    } else {
+      PASS();
+    }
+  }
+#else
+  TEST("fsp_trace_enable reports tracing not built in");
+  {
+    fsp_context *ctx = fsp_create();
+
+    if(!ctx || fsp_trace_enable(ctx, 16) != -1 ||
+       fsp_trace_drain(ctx, NULL, NULL) != 0) {
+      FAIL("Expected -1 without FSP_TRACE");
+    } else {
+      PASS();
+    }
+    if(ctx)
+      fsp_destroy(ctx);
+  }
+#endif
+
+  /* Test 49: Vectored appends honor the spill-to-disk contract */
+#ifdef HAVE_SYS_MMAN_H
+  TEST("fsp_buffer_append_iov spills like the scalar append");
+  {
+    fsp_config spill_config;
+    fsp_iovec iov[3];
+    int spill_ok = 1;
+    char pattern[96];
+    char out[128];
+    size_t fed = 0;
+    size_t drained = 0;
+    size_t i;
+    int n;
+
+    fsp_config_init(&spill_config);
+    spill_config.initial_buffer_size = 1024;
+    spill_config.spill_threshold = 1024;
+
+    for(i = 0; i < sizeof(pattern); i++)
+      pattern[i] = (char)('a' + (i % 26));
+
+    ctx = fsp_create_with_config(&spill_config);
+    if(!ctx) {
+      FAIL("Failed to create context");
+    } else {
+      /* Feed 32KB of three-fragment messages - far past the
+       * threshold - without reading */
+      iov[0].iov_base = pattern;
+      iov[0].iov_len = 32;
+      iov[1].iov_base = pattern + 32;
+      iov[1].iov_len = 32;
+      iov[2].iov_base = pattern + 64;
+      iov[2].iov_len = 32;
+
+      while(fed < 32 * 1024) {
+        if(fsp_buffer_append_iov(ctx, iov, 3) != 0) {
+          spill_ok = 0;
+          break;
+        }
+        fed += sizeof(pattern);
+      }
+
+      /* The backlog overflowed to disk; RAM stayed bounded */
+      if(spill_ok &&
+         (ctx->spill_length == 0 || ctx->buffer_capacity > 2048 ||
+          fsp_buffer_available(ctx) != fed))
+        spill_ok = 0;
+
+      /* Everything reads back in order, fragments included */
+      while(spill_ok && (n = fsp_read_input(ctx, out, sizeof(out))) > 0) {
+        for(i = 0; i < (size_t)n; i++) {
+          if(out[i] != pattern[(drained + i) % sizeof(pattern)]) {
+            spill_ok = 0;
+            break;
+          }
+        }
+        drained += (size_t)n;
+      }
+      if(spill_ok && drained != fed)
+        spill_ok = 0;
+
+      fsp_destroy(ctx);
+
+      if(!spill_ok) {
+        FAIL("Vectored append broke the spill contract");
+      } else {
+        PASS();
+      }
+    }
+  }
+#endif
+
+  /* Test 50: Stream id reuse immediately after the end chunk */
+  TEST("fsp_pool id reuse after end chunk loses no chunks");
+  {
+    static pool_tally tally;
+    static const char pool_chunk[] = "let r = 9; ";
+    fsp_pool *pool;
+    int pool_ok = 1;
+    int chunk;
+
+    memset(&tally, '\0', sizeof(tally));
+
+    pool = fsp_pool_create(2, pool_test_callback, &tally);
+    if(!pool) {
+      FAIL("Failed to create pool");
+    } else {
+      /* First life of stream 5: two chunks and an end marker */
+      for(chunk = 0; pool_ok && chunk < 2; chunk++) {
+        if(fsp_pool_submit(pool, 5, pool_chunk, strlen(pool_chunk), 0) != 0)
+          pool_ok = 0;
+      }
+      if(pool_ok && fsp_pool_submit(pool, 5, NULL, 0, 1) != 0)
+        pool_ok = 0;
+
+      /* Reuse the id immediately - no flush, so the old stream may
+       * still be dying on a worker.  These must reach a fresh stream,
+       * not be dropped with the retiring one. */
+      for(chunk = 0; pool_ok && chunk < 3; chunk++) {
+        if(fsp_pool_submit(pool, 5, pool_chunk, strlen(pool_chunk), 0) != 0)
+          pool_ok = 0;
+      }
+      if(pool_ok && fsp_pool_submit(pool, 5, NULL, 0, 1) != 0)
+        pool_ok = 0;
+
+      if(pool_ok && fsp_pool_flush(pool) != 0)
+        pool_ok = 0;
+
+      /* Both lives together: 5 data chunks + 2 end markers, all bytes */
+      if(pool_ok &&
+         (tally.chunks[5] != 7 || tally.bytes[5] != 5 * strlen(pool_chunk)))
+        pool_ok = 0;
+
+      fsp_pool_destroy(pool);
+
+      if(!pool_ok) {
+        FAIL("Chunks lost across id reuse");
+      } else {
+        PASS();
+      }
+    }
+  }
+
   /* Summary */
   fprintf(stderr, "\n==================\n");
   fprintf(stderr, "Tests run: %d\n", test_count);
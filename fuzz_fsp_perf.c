@@ -0,0 +1,527 @@
+/*
+ * fuzz_fsp_perf.c - Worst-case throughput harness for libfsp
+ *
+ * Purpose:
+ *  - Companion to fuzz_fsp_parse.c that chases performance regressions
+ *    instead of crashes: runs the checked-in corpus plus generated
+ *    pathological workloads (1-byte chunk storms, compaction churn,
+ *    tokens split across tiny chunks) through the streaming parser and
+ *    records ns/byte per input class.
+ *  - With a baseline file (-b) the run fails if any class regresses
+ *    beyond the threshold, making worst-case throughput a tested
+ *    property; -w (re)writes the baseline for the current host.
+ *
+ * Notes:
+ *  - Build sanitizer-free and optimized (see the fuzz-perf target in
+ *    GNUMakefile); sanitized or -O0 numbers are meaningless.
+ *  - Baselines are host-specific: regenerate with fuzz-perf-baseline
+ *    on the machine that will run the comparisons.
+ *
+ * Usage: fuzz_fsp_perf [-b BASELINE] [-w BASELINE] [-t PERCENT] [DIR...]
+ *   -b  compare against BASELINE, exit 1 on regression
+ *   -w  write measured results to BASELINE
+ *   -t  allowed regression in percent (default 30)
+ *   DIR corpus directories; every .txt file becomes an input class
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#include "fsp.h"
+#include "fsp_internal.h"  /* For direct access to context internals */
+#include "test_parser.h"
+
+/* Define YYSTYPE for lexer header */
+#define YYSTYPE TEST_PARSER_STYPE
+#include "test_lexer.h"
+
+/* Minimum buffered bytes before calling the lexer; see fsp_test.c */
+#define MIN_BUFFER_FOR_LEX 16
+
+/* Bytes each class pushes per timed repetition; small corpus files
+ * are looped until they reach this */
+#define PERF_CLASS_BYTES (256 * 1024)
+
+/* Timed repetitions per class; the best one is recorded so scheduler
+ * noise does not read as a regression */
+#define PERF_REPEATS 3
+
+#define PERF_MAX_CLASSES 64
+#define PERF_NAME_MAX 128
+
+typedef struct perf_result_s {
+  char name[PERF_NAME_MAX];
+  double ns_per_byte;
+} perf_result;
+
+static perf_result perf_results[PERF_MAX_CLASSES];
+static int perf_result_count = 0;
+
+/* Monotonic timestamp in seconds */
+static double
+perf_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Stream @input through the full lexer/push-parser pipeline in
+ * @chunk_size chunks.  Parse errors are fine - adversarial inputs are
+ * often invalid - only the byte-pushing throughput matters here. */
+static void
+perf_run_parse(const char *input, size_t input_len, size_t chunk_size)
+{
+  fsp_context *ctx;
+  yyscan_t scanner;
+  test_parser_pstate *pstate;
+  size_t pos = 0;
+  int failed = 0;
+
+  test_parser_reset();
+
+  ctx = fsp_create();
+  if(!ctx)
+    return;
+
+  if(test_lexer_lex_init(&scanner)) {
+    fsp_destroy(ctx);
+    return;
+  }
+  test_lexer_set_extra(ctx, scanner);
+
+  pstate = test_parser_pstate_new();
+  if(!pstate) {
+    test_lexer_lex_destroy(scanner);
+    fsp_destroy(ctx);
+    return;
+  }
+
+  while(pos < input_len) {
+    size_t chunk;
+    int is_eof;
+
+    chunk = input_len - pos;
+    if(chunk > chunk_size)
+      chunk = chunk_size;
+
+    if(fsp_buffer_append(ctx, input + pos, chunk) < 0)
+      break;
+    pos += chunk;
+
+    is_eof = (pos >= input_len);
+    if(is_eof)
+      ctx->more_chunks_expected = 0;
+
+    if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+      continue;
+
+    while(fsp_buffer_available(ctx) > 0 || is_eof) {
+      TEST_PARSER_STYPE lval;
+      int token;
+      int status;
+
+      if(!is_eof && fsp_buffer_available(ctx) < MIN_BUFFER_FOR_LEX)
+        break;
+
+      memset(&lval, 0, sizeof(lval));
+      token = test_lexer_lex(&lval, scanner);
+
+      if(token == 0)
+        break;
+
+      if(token == ERROR) {
+        if(lval.string)
+          free(lval.string);
+        failed = 1;
+        break;
+      }
+
+      status = test_parser_push_parse(pstate, token, &lval, ctx, scanner);
+      if(status != YYPUSH_MORE) {
+        failed = 1;
+        break;
+      }
+    }
+
+    if(failed)
+      break;
+  }
+
+  if(!failed)
+    (void)test_parser_push_parse(pstate, 0, NULL, ctx, scanner);
+
+  test_parser_pstate_delete(pstate);
+  test_lexer_lex_destroy(scanner);
+  fsp_destroy(ctx);
+  test_parser_free_statements();
+}
+
+/* Record the best-of-N ns/byte for one class */
+static void
+perf_record(const char *name, double best_seconds, size_t bytes)
+{
+  perf_result *result;
+
+  if(perf_result_count >= PERF_MAX_CLASSES || bytes == 0)
+    return;
+
+  result = &perf_results[perf_result_count++];
+  snprintf(result->name, sizeof(result->name), "%s", name);
+  result->ns_per_byte = best_seconds * 1e9 / (double)bytes;
+
+  printf("class=%s bytes=%zu ns_per_byte=%.3f\n",
+         result->name, bytes, result->ns_per_byte);
+}
+
+/* Time @repeats runs of the parse pipeline and record the best */
+static void
+perf_class_parse(const char *name, const char *input, size_t input_len,
+                 size_t chunk_size)
+{
+  double best = -1.0;
+  int i;
+
+  for(i = 0; i < PERF_REPEATS; i++) {
+    double start = perf_now();
+    perf_run_parse(input, input_len, chunk_size);
+    double elapsed = perf_now() - start;
+    if(best < 0.0 || elapsed < best)
+      best = elapsed;
+  }
+
+  perf_record(name, best, input_len);
+}
+
+/* Generated class: many tiny statements fed one byte at a time - the
+ * chunk-storm pattern that stresses per-append overhead */
+static void
+perf_gen_byte_storm(void)
+{
+  const char *stmt = "let v1 = 42; print \"hi\"; ";
+  size_t stmt_len = strlen(stmt);
+  size_t count = PERF_CLASS_BYTES / stmt_len + 1;
+  char *input = (char*)malloc(count * stmt_len + 1);
+  size_t i;
+
+  if(!input)
+    return;
+  for(i = 0; i < count; i++)
+    memcpy(input + i * stmt_len, stmt, stmt_len);
+  input[count * stmt_len] = '\0';
+
+  perf_class_parse("gen_byte_storm", input, count * stmt_len, 1);
+  free(input);
+}
+
+/* Generated class: long triple-quoted strings in 3-byte chunks, so
+ * nearly every token crosses a chunk boundary */
+static void
+perf_gen_split_longstr(void)
+{
+  const char *head = "print \"\"\"";
+  const char *tail = "\"\"\"; ";
+  size_t body_len = 512;
+  size_t stmt_len = strlen(head) + body_len + strlen(tail);
+  size_t count = PERF_CLASS_BYTES / stmt_len + 1;
+  char *input = (char*)malloc(count * stmt_len + 1);
+  char *p;
+  size_t i;
+
+  if(!input)
+    return;
+  p = input;
+  for(i = 0; i < count; i++) {
+    memcpy(p, head, strlen(head));
+    p += strlen(head);
+    memset(p, 'x', body_len);
+    p += body_len;
+    memcpy(p, tail, strlen(tail));
+    p += strlen(tail);
+  }
+  *p = '\0';
+
+  perf_class_parse("gen_split_longstr", input, (size_t)(p - input), 3);
+  free(input);
+}
+
+/* Generated class: buffer-level compaction churn - a nearly-full
+ * buffer with a large unread tail, drained and refilled 64 bytes at a
+ * time so every append slides the whole tail.  This is the worst-case
+ * compaction pattern, measured without the lexer in the way. */
+static void
+perf_gen_compaction_churn(void)
+{
+  enum { CHURN_STEP = 64, CHURN_ITERATIONS = 2000 };
+  char fill[48 * 1024];
+  char out[CHURN_STEP];
+  double best = -1.0;
+  int i, rep;
+
+  memset(fill, 'x', sizeof(fill));
+
+  for(rep = 0; rep < PERF_REPEATS; rep++) {
+    fsp_context *ctx = fsp_create();
+    double start;
+
+    if(!ctx)
+      return;
+
+    /* Build the large unread tail, then advance just far enough that
+     * each append must compact to fit */
+    (void)fsp_buffer_append(ctx, fill, sizeof(fill));
+    while(ctx->buffer_capacity - ctx->data_length >= CHURN_STEP)
+      (void)fsp_buffer_append(ctx, fill, CHURN_STEP);
+    (void)fsp_read_input(ctx, out, CHURN_STEP);
+
+    start = perf_now();
+    for(i = 0; i < CHURN_ITERATIONS; i++) {
+      (void)fsp_buffer_append(ctx, fill, CHURN_STEP);
+      (void)fsp_read_input(ctx, out, CHURN_STEP);
+    }
+    {
+      double elapsed = perf_now() - start;
+      if(best < 0.0 || elapsed < best)
+        best = elapsed;
+    }
+    fsp_destroy(ctx);
+  }
+
+  perf_record("gen_compaction_churn", best,
+              (size_t)CHURN_ITERATIONS * CHURN_STEP);
+}
+
+/* File class: the corpus input looped up to PERF_CLASS_BYTES and fed
+ * in 1-byte chunks */
+static void
+perf_class_file(const char *dir, const char *name)
+{
+  char path[512];
+  char class_name[PERF_NAME_MAX];
+  FILE *fh;
+  long file_len;
+  size_t total, copies, i;
+  char *raw;
+  char *input;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fh = fopen(path, "rb");
+  if(!fh)
+    return;
+  fseek(fh, 0, SEEK_END);
+  file_len = ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+  if(file_len <= 0) {
+    fclose(fh);
+    return;
+  }
+
+  raw = (char*)malloc((size_t)file_len);
+  if(!raw || fread(raw, 1, (size_t)file_len, fh) != (size_t)file_len) {
+    free(raw);
+    fclose(fh);
+    return;
+  }
+  fclose(fh);
+
+  copies = PERF_CLASS_BYTES / (size_t)file_len;
+  if(copies < 1)
+    copies = 1;
+  total = copies * (size_t)file_len;
+  input = (char*)malloc(total);
+  if(!input) {
+    free(raw);
+    return;
+  }
+  for(i = 0; i < copies; i++)
+    memcpy(input + i * (size_t)file_len, raw, (size_t)file_len);
+  free(raw);
+
+  snprintf(class_name, sizeof(class_name), "%s", name);
+  perf_class_parse(class_name, input, total, 1);
+  free(input);
+}
+
+static int
+perf_name_compare(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Every .txt file in @dir becomes an input class, in sorted order so
+ * runs are deterministic.  The baseline file itself is skipped. */
+static void
+perf_scan_dir(const char *dir)
+{
+  DIR *dh = opendir(dir);
+  struct dirent *entry;
+  char *names[PERF_MAX_CLASSES];
+  int count = 0;
+  int i;
+
+  if(!dh) {
+    fprintf(stderr, "fuzz_fsp_perf: cannot open corpus dir %s\n", dir);
+    return;
+  }
+
+  while((entry = readdir(dh)) && count < PERF_MAX_CLASSES) {
+    size_t len = strlen(entry->d_name);
+    if(len < 5 || strcmp(entry->d_name + len - 4, ".txt") != 0)
+      continue;
+    if(!strcmp(entry->d_name, "baseline.txt"))
+      continue;
+    names[count] = (char*)malloc(len + 1);
+    if(names[count]) {
+      memcpy(names[count], entry->d_name, len + 1);
+      count++;
+    }
+  }
+  closedir(dh);
+
+  qsort(names, (size_t)count, sizeof(char*), perf_name_compare);
+  for(i = 0; i < count; i++) {
+    perf_class_file(dir, names[i]);
+    free(names[i]);
+  }
+}
+
+/* Compare results against @baseline_path; returns the number of
+ * classes past the threshold */
+static int
+perf_compare(const char *baseline_path, double threshold_percent)
+{
+  FILE *fh = fopen(baseline_path, "r");
+  char line[256];
+  int regressions = 0;
+  int compared = 0;
+  int i;
+
+  if(!fh) {
+    fprintf(stderr, "fuzz_fsp_perf: no baseline %s (run with -w first)\n",
+            baseline_path);
+    return 1;
+  }
+
+  for(i = 0; i < perf_result_count; i++)
+    perf_results[i].name[PERF_NAME_MAX - 1] = '\0';
+
+  while(fgets(line, sizeof(line), fh)) {
+    char name[PERF_NAME_MAX];
+    double baseline_value;
+
+    if(line[0] == '#' || line[0] == '\n')
+      continue;
+    if(sscanf(line, "%127s %lf", name, &baseline_value) != 2)
+      continue;
+
+    for(i = 0; i < perf_result_count; i++) {
+      double limit;
+
+      if(strcmp(perf_results[i].name, name))
+        continue;
+
+      compared++;
+      limit = baseline_value * (1.0 + threshold_percent / 100.0);
+      if(perf_results[i].ns_per_byte > limit) {
+        fprintf(stderr,
+                "REGRESSION %s: %.3f ns/byte vs baseline %.3f "
+                "(limit %.3f)\n",
+                name, perf_results[i].ns_per_byte, baseline_value, limit);
+        regressions++;
+      }
+      break;
+    }
+  }
+  fclose(fh);
+
+  if(!compared)
+    fprintf(stderr,
+            "fuzz_fsp_perf: baseline %s has no matching classes; "
+            "regenerate it with -w\n", baseline_path);
+
+  printf("compared=%d regressions=%d threshold=%.0f%%\n",
+         compared, regressions, threshold_percent);
+  return regressions;
+}
+
+/* Write the measured results as a new baseline */
+static int
+perf_write_baseline(const char *baseline_path)
+{
+  FILE *fh = fopen(baseline_path, "w");
+  int i;
+
+  if(!fh) {
+    fprintf(stderr, "fuzz_fsp_perf: cannot write %s\n", baseline_path);
+    return -1;
+  }
+
+  fprintf(fh, "# fuzz_fsp_perf baseline: ns/byte per input class\n");
+  fprintf(fh, "# Host-specific - regenerate on the comparison machine\n");
+  fprintf(fh, "# with: make -f GNUMakefile fuzz-perf-baseline\n");
+  for(i = 0; i < perf_result_count; i++)
+    fprintf(fh, "%s %.3f\n", perf_results[i].name,
+            perf_results[i].ns_per_byte);
+  fclose(fh);
+
+  printf("wrote %d classes to %s\n", perf_result_count, baseline_path);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *compare_path = NULL;
+  const char *write_path = NULL;
+  double threshold_percent = 30.0;
+  int arg = 1;
+
+  test_parser_set_quiet(1);
+
+  while(arg < argc && argv[arg][0] == '-') {
+    if(!strcmp(argv[arg], "-b") && arg + 1 < argc)
+      compare_path = argv[++arg];
+    else if(!strcmp(argv[arg], "-w") && arg + 1 < argc)
+      write_path = argv[++arg];
+    else if(!strcmp(argv[arg], "-t") && arg + 1 < argc)
+      threshold_percent = atof(argv[++arg]);
+    else {
+      fprintf(stderr,
+              "Usage: fuzz_fsp_perf [-b BASELINE] [-w BASELINE] "
+              "[-t PERCENT] [DIR...]\n");
+      return 1;
+    }
+    arg++;
+  }
+
+  /* Generated pathological classes */
+  perf_gen_byte_storm();
+  perf_gen_split_longstr();
+  perf_gen_compaction_churn();
+
+  /* Corpus directories */
+  for(; arg < argc; arg++)
+    perf_scan_dir(argv[arg]);
+
+  if(write_path && perf_write_baseline(write_path) < 0)
+    return 1;
+
+  if(compare_path)
+    return perf_compare(compare_path, threshold_percent) ? 1 : 0;
+
+  return 0;
+}
@@ -14,22 +14,94 @@ Usage:
   bison -o parser.c parser.y
   python3 postprocess-bison.py parser.c
 
+With -b/--batch-driver it also appends the <prefix>drive_fsp_parser()
+glue for fsp_drive_parser(), which runs the yylex/yypush_parse pair in
+a tight loop inside the generated parser (see fsp.h).
+
 The script modifies the file in-place, creating a .bak backup.
 
 (C) Copyright 2024-2025 Dave Beckett https://www.dajobe.org/
 """
 
+import argparse
 import os
 import re
-import sys
+from typing import Optional
 
 EXTENSION = ".bak"
 
 
-def fix(file):
+def batch_driver_code(parser_prefix: str, lexer_prefix: str) -> str:
+    """
+    Build the <parser_prefix>drive_fsp_parser() code injected by
+    --batch-driver.
+
+    The code is guarded on FSP_H (the fsp.h include guard) so it only
+    materializes when the grammar actually includes the libfsp header,
+    and assumes the library's documented integration pattern:
+
+        %define api.pure full
+        %define api.push-pull push
+        %parse-param { fsp_context* fsp_ctx } { void* yyscanner }
+
+    Args:
+        parser_prefix: Parser symbol prefix such as 'test_parser_'
+        lexer_prefix: Lexer symbol prefix such as 'test_lexer_'
+    """
+    return f"""
+/* Added by postprocess-bison.py --batch-driver: run the
+ * yylex/yypush_parse pair in a tight loop inside one call, keeping
+ * the parser state hot instead of paying the host's per-token call
+ * overhead.  Register with fsp_set_parser_driver() and invoke through
+ * fsp_drive_parser(). */
+#ifdef FSP_H
+fsp_status {parser_prefix}drive_fsp_parser ( fsp_context * fsp_ctx , int max_tokens , void * user_data );
+
+fsp_status
+{parser_prefix}drive_fsp_parser ( fsp_context * fsp_ctx , int max_tokens , void * user_data )
+{{
+    yypstate *yyps = (yypstate *) fsp_get_parser_state( fsp_ctx );
+    yyscan_t scanner = (yyscan_t) fsp_get_lexer_scanner( fsp_ctx );
+    YYSTYPE yylval_batch;
+    int yybudget = max_tokens;
+    (void) user_data;
+
+    if ( !yyps || !scanner )
+        return FSP_STATUS_ERROR;
+
+    for ( ;; ) {{
+        int yytok;
+        int yystatus;
+
+        if ( max_tokens > 0 && yybudget-- == 0 )
+            return FSP_STATUS_AGAIN;
+
+        yytok = {lexer_prefix}lex( &yylval_batch, scanner );
+
+        if ( yytok == 0 ) {{
+            if ( !fsp_stream_at_end( fsp_ctx ) )
+                return FSP_STATUS_NEED_DATA;
+            /* Real end of input: push EOF and finish the parse */
+            yystatus = yypush_parse( yyps, 0, NULL, fsp_ctx, scanner );
+            return yystatus == 0 ? FSP_STATUS_OK : FSP_STATUS_ERROR;
+        }}
+
+        yystatus = yypush_parse( yyps, yytok, &yylval_batch, fsp_ctx, scanner );
+        if ( yystatus == YYPUSH_MORE )
+            continue;
+        return yystatus == 0 ? FSP_STATUS_OK : FSP_STATUS_ERROR;
+    }}
+}}
+#endif /* FSP_H */
+"""
+
+
+def fix(file: str, batch_driver: Optional[str] = None) -> None:
     backup = file + EXTENSION
     os.rename(file, backup)
     with open(backup, "r") as infile, open(file, "w") as outfile:
+        # Parser symbol prefix such as 'test_parser_' (api.prefix)
+        parser_prefix = "yy"
         seen_yyerrlab1 = False
         syntax_error_has_default = False
         in_yydestruct_function = False
@@ -40,6 +112,12 @@ def fix(file):
         s = list(enumerate(infile, start=1))
         while s:
             (line_number, line) = s.pop(0)
+
+            # Note the api.prefix substitution for --batch-driver
+            prefix_match = re.match(r"^#define yypush_parse\s+(\w+)push_parse", line)
+            if prefix_match:
+                parser_prefix = prefix_match.group(1)
+
             # Remove block of code that causes a warning
             if "Suppress GCC warning that yyerrlab1" in line:
                 while True:
@@ -149,10 +227,23 @@ def fix(file):
 
             outfile.write(line)
 
-
-def main():
-    for file in sys.argv[1:]:
-        fix(file)
+        if batch_driver:
+            outfile.write(batch_driver_code(parser_prefix, batch_driver))
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="Format bison output")
+    parser.add_argument("FILES", nargs="+", help="Bison-generated .c files")
+    parser.add_argument(
+        "-b",
+        "--batch-driver",
+        metavar="LEXER_PREFIX",
+        help="Append the <prefix>drive_fsp_parser() batched lex/push "
+        "loop for fsp_drive_parser(), calling <LEXER_PREFIX>lex()",
+    )
+    args = parser.parse_args()
+    for file in args.FILES:
+        fix(file, args.batch_driver)
 
 
 if __name__ == "__main__":
@@ -35,6 +35,10 @@ Options:
   -g, --guard-macro NAME      Guard macro name (default: HAVE_CONFIG_H)
                               Use your project's guard (e.g., HAVE_RAPTOR_CONFIG_H)
   -o, --output PATH           Write output to file instead of stdout
+  -s, --in-place-scan         Add a <prefix>scan_fsp_window() entry point that
+                              arms the scanner directly on the libfsp stream
+                              buffer via yy_scan_buffer(), bypassing the
+                              YY_INPUT copy (see fsp_scan_window() in fsp.h)
 
 (C) Copyright 2024-2025 Dave Beckett https://www.dajobe.org/
 """
@@ -47,8 +51,51 @@ import sys
 logger = logging.getLogger(__name__)
 
 
+def in_place_scan_code(prefix: str, is_header: bool) -> str:
+    """
+    Build the <prefix>scan_fsp_window() code injected by --in-place-scan.
+
+    The code is guarded on FSP_H (the fsp.h include guard) so it only
+    materializes when the lexer actually includes the libfsp header.
+
+    Args:
+        prefix: Lexer symbol prefix such as 'test_lexer_'
+        is_header: True to emit the prototype, False for the definition
+    """
+    if is_header:
+        body = f"YY_BUFFER_STATE {prefix}scan_fsp_window ( fsp_context * fsp_ctx , yyscan_t yyscanner );\n"
+    else:
+        body = f"""\
+YY_BUFFER_STATE {prefix}scan_fsp_window ( fsp_context * fsp_ctx , yyscan_t yyscanner )
+{{
+    char *base = NULL;
+    size_t window_len = 0;
+
+    if ( fsp_scan_window( fsp_ctx, &base, &window_len ) < 0 )
+        return NULL;
+
+    /* fsp_scan_window() placed the two YY_END_OF_BUFFER_CHAR
+     * sentinels after the unread bytes */
+    return {prefix}_scan_buffer( base, window_len + 2 , yyscanner );
+}}
+"""
+    return f"""
+/* Added by postprocess-flex.py --in-place-scan: arm the scanner
+ * directly on the libfsp stream buffer, bypassing the YY_INPUT copy.
+ * Lex until the scanner stalls at the window end, then report the
+ * bytes covered by complete tokens with fsp_scan_window_consume(),
+ * append the next chunk and re-arm. */
+#ifdef FSP_H
+{body}#endif /* FSP_H */
+"""
+
+
 def fix(
-    flex_input_file, config_header="fsp_config.h", guard_macro=None, output_path=None
+    flex_input_file,
+    config_header="fsp_config.h",
+    guard_macro=None,
+    output_path=None,
+    in_place_scan=False,
 ):
     """
     Formats flex output according to specified rules.
@@ -58,6 +105,7 @@ def fix(
         config_header: Name of the config header to include (default: fsp_config.h)
         guard_macro: Guard macro name (default: HAVE_CONFIG_H)
         output_path: Optional output file path (default: stdout)
+        in_place_scan: Append the <prefix>scan_fsp_window() entry point
     """
     f_out = sys.stdout
     if output_path:
@@ -258,6 +306,10 @@ def fix(
                 )
 
                 f_out.write(line)
+
+            if in_place_scan and prefix:
+                is_header = flex_input_file.endswith(".h")
+                f_out.write(in_place_scan_code(prefix, is_header))
     finally:
         if output_path:
             f_out.close()
@@ -281,6 +333,13 @@ def main():
     parser.add_argument(
         "-o", "--output", default=None, help="Write output to file instead of stdout"
     )
+    parser.add_argument(
+        "-s",
+        "--in-place-scan",
+        action="store_true",
+        help="Add a scan_fsp_window() entry point scanning the libfsp "
+        "stream buffer in place (requires the lexer to include fsp.h)",
+    )
     parser.add_argument("-d", "--debug", action="store_true", help="Enable debug mode")
     args = parser.parse_args()
 
@@ -289,7 +348,13 @@ def main():
     else:
         logging.basicConfig(level=logging.INFO)
 
-    fix(args.INPUT, args.config_header, args.guard_macro, args.output)
+    fix(
+        args.INPUT,
+        args.config_header,
+        args.guard_macro,
+        args.output,
+        args.in_place_scan,
+    )
 
 
 if __name__ == "__main__":
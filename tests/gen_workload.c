@@ -0,0 +1,295 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * gen_workload.c - Deterministic synthetic workload generator
+ *
+ * Produces large (MB to GB) toy-language inputs for the perf-check
+ * target, scaling the byte-sized samples in tests/ up to sizes that
+ * actually exercise buffer growth, compaction under backlog and
+ * multi-MB token handling.  Output is deterministic for a given
+ * profile, size and seed; the exact statement count is printed on
+ * stdout so the checker can assert correctness, not just speed.
+ *
+ * Profiles:
+ *   statements - statement-dense: many short let/print statements
+ *   strings    - giant triple-quoted strings (multi-MB single tokens)
+ *   mixed      - interleaved statements and medium strings
+ *   fragment   - worst-case fragmentation: very long identifiers and
+ *                integers with no whitespace runs, so tokens straddle
+ *                chunk boundaries at any chunk size
+ *
+ * Copyright (C) 2025, Dave Beckett https://www.dajobe.org/
+ *
+ * This package is Free Software
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Deterministic generator state (xorshift64) - independent of the C
+ * library's rand() so output is identical across platforms */
+static unsigned long long rng_state = 1;
+
+static unsigned long long
+rng_next(void)
+{
+  unsigned long long x = rng_state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  rng_state = x;
+  return x;
+}
+
+/* Bounded random value */
+static size_t
+rng_below(size_t bound)
+{
+  return (size_t)(rng_next() % bound);
+}
+
+/* Output accounting */
+static FILE *out_fp;
+static size_t out_bytes = 0;
+static long out_statements = 0;
+
+static void
+emit(const char *data, size_t length)
+{
+  if(fwrite(data, 1, length, out_fp) != length) {
+    fprintf(stderr, "gen_workload: write failed\n");
+    exit(1);
+  }
+  out_bytes += length;
+}
+
+static void
+emit_str(const char *s)
+{
+  emit(s, strlen(s));
+}
+
+/* Identifier of the given length into buf (not NUL terminated) */
+static void
+fill_identifier(char *buf, size_t length)
+{
+  size_t i;
+
+  buf[0] = (char)('a' + rng_below(26));
+  for(i = 1; i < length; i++) {
+    unsigned long long r = rng_next();
+
+    if((r & 7) == 0)
+      buf[i] = '_';
+    else if((r & 7) == 1)
+      buf[i] = (char)('0' + (r >> 8) % 10);
+    else
+      buf[i] = (char)('a' + (r >> 8) % 26);
+  }
+}
+
+/* One short statement: let x123 = 42; / print "..."; / print name; */
+static void
+emit_short_statement(void)
+{
+  char ident[16];
+  char number[24];
+  size_t ident_len = 1 + rng_below(8);
+
+  fill_identifier(ident, ident_len);
+  ident[ident_len] = '\0';
+
+  switch(rng_below(3)) {
+    case 0:
+      snprintf(number, sizeof(number), "%lu",
+               (unsigned long)rng_below(1000000));
+      emit_str("let ");
+      emit_str(ident);
+      emit_str(" = ");
+      emit_str(number);
+      emit_str(";\n");
+      break;
+    case 1:
+      emit_str("print \"");
+      emit_str(ident);
+      emit_str("\";\n");
+      break;
+    default:
+      emit_str("print ");
+      emit_str(ident);
+      emit_str(";\n");
+      break;
+  }
+  out_statements++;
+}
+
+/* One giant triple-quoted string statement with a body of body_len
+ * content bytes (letters, spaces and newlines; never a quote) */
+static void
+emit_long_string_statement(size_t body_len)
+{
+  char block[8192];
+  size_t done = 0;
+  size_t i;
+
+  emit_str("let s = \"\"\"");
+  while(done < body_len) {
+    size_t n = body_len - done;
+
+    if(n > sizeof(block))
+      n = sizeof(block);
+    for(i = 0; i < n; i++) {
+      unsigned long long r = rng_next();
+
+      if((r & 31) == 0)
+        block[i] = '\n';
+      else if((r & 31) == 1)
+        block[i] = ' ';
+      else
+        block[i] = (char)('a' + (r >> 8) % 26);
+    }
+    emit(block, n);
+    done += n;
+  }
+  emit_str("\"\"\";\n");
+  out_statements++;
+}
+
+/* One fragmentation statement: a single long identifier and a long
+ * integer with single-space separation, so almost every chunk cut
+ * lands mid-token */
+static void
+emit_fragment_statement(void)
+{
+  char ident[4096];
+  char number[512];
+  size_t ident_len = 512 + rng_below(sizeof(ident) - 512);
+  size_t number_len = 16 + rng_below(sizeof(number) - 17);
+  size_t i;
+
+  fill_identifier(ident, ident_len);
+
+  number[0] = (char)('1' + rng_below(9));
+  for(i = 1; i < number_len; i++)
+    number[i] = (char)('0' + rng_below(10));
+
+  emit_str("let ");
+  emit(ident, ident_len);
+  emit_str(" = ");
+  emit(number, number_len);
+  emit_str(";");
+  out_statements++;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+          "Usage: gen_workload [-s SEED] [-o FILE] PROFILE SIZE_MB\n"
+          "Profiles: statements strings mixed fragment\n"
+          "Writes at least SIZE_MB MB of deterministic toy-language\n"
+          "input and prints the statement count on stdout.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *profile = NULL;
+  const char *out_path = NULL;
+  size_t target_bytes;
+  long size_mb = 0;
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-s") && i + 1 < argc) {
+      rng_state = (unsigned long long)strtoul(argv[++i], NULL, 10);
+      if(!rng_state)
+        rng_state = 1;
+    } else if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if(!strcmp(argv[i], "-h")) {
+      usage();
+      return 0;
+    } else if(!profile) {
+      profile = argv[i];
+    } else if(!size_mb) {
+      size_mb = strtol(argv[i], NULL, 10);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if(!profile || size_mb <= 0) {
+    usage();
+    return 1;
+  }
+  target_bytes = (size_t)size_mb * 1024 * 1024;
+
+  if(out_path) {
+    out_fp = fopen(out_path, "wb");
+    if(!out_fp) {
+      fprintf(stderr, "gen_workload: cannot open %s\n", out_path);
+      return 1;
+    }
+  } else
+    out_fp = stdout;
+
+  if(!strcmp(profile, "statements")) {
+    while(out_bytes < target_bytes)
+      emit_short_statement();
+  } else if(!strcmp(profile, "strings")) {
+    while(out_bytes < target_bytes) {
+      /* 1MB-4MB single tokens */
+      size_t body = (1 + rng_below(4)) * 1024 * 1024;
+
+      if(body > target_bytes - out_bytes + 1024 * 1024)
+        body = 1024 * 1024;
+      emit_long_string_statement(body);
+    }
+  } else if(!strcmp(profile, "mixed")) {
+    while(out_bytes < target_bytes) {
+      size_t burst = 16 + rng_below(64);
+
+      while(burst-- > 0 && out_bytes < target_bytes)
+        emit_short_statement();
+      if(out_bytes < target_bytes)
+        emit_long_string_statement(4096 + rng_below(256 * 1024));
+    }
+  } else if(!strcmp(profile, "fragment")) {
+    while(out_bytes < target_bytes)
+      emit_fragment_statement();
+  } else {
+    fprintf(stderr, "gen_workload: unknown profile '%s'\n", profile);
+    usage();
+    if(out_path)
+      fclose(out_fp);
+    return 1;
+  }
+
+  if(out_path && fclose(out_fp) != 0) {
+    fprintf(stderr, "gen_workload: close failed\n");
+    return 1;
+  }
+
+  fprintf(stderr, "gen_workload: %s: %lu bytes, %ld statements\n",
+          profile, (unsigned long)out_bytes, out_statements);
+  /* Machine-readable: the checker asserts this exact count */
+  if(out_path)
+    printf("%ld\n", out_statements);
+
+  return 0;
+}